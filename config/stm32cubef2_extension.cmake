@@ -3,6 +3,19 @@ set(PROJECT_UBINOS_LIBRARIES ${PROJECT_UBINOS_LIBRARIES} stm32cubef2_extension)
 
 set_cache_default(STM32CUBEF2__DTTY_STM32_UART_ENABLE FALSE BOOL "")
 
-set_cache_default(STM32CUBEF2__DTTY_STM32_UART_READ_BUFFER_SIZE "512" STRING "stm32cubef2 dtty uart read buffer size")
-set_cache_default(STM32CUBEF2__DTTY_STM32_UART_WRITE_BUFFER_SIZE "1024 * 10" STRING "stm32cubef2 dtty uart read buffer size")
+set_cache_default(STM32CUBEF2__DTTY_STM32_UART_READ_BUFFER_SIZE "512" STRING "stm32cubef2 dtty uart read buffer size (power of two)")
+set_cache_default(STM32CUBEF2__DTTY_STM32_UART_WRITE_BUFFER_SIZE "1024 * 8" STRING "stm32cubef2 dtty uart write buffer size (power of two)")
+set_cache_default(STM32CUBEF2__DTTY_STM32_UART_BAUD_RATE "115200" STRING "stm32cubef2 dtty uart baud rate")
+set_cache_default(STM32CUBEF2__DTTY_STM32_UART_LOG_BUFFER_SIZE "1024 * 4" STRING "stm32cubef2 dtty uart deferred output buffer size (power of two, 0: write in the caller)")
+set_cache_default(STM32CUBEF2__DTTY_STM32_UART_NEWLIB_WRITE FALSE BOOL "stm32cubef2 dtty uart provides the newlib _write of stdout and stderr")
 
+set_cache_default(STM32CUBEF2__UBIDRV_UART_CHECK_INTERVAL_MS "1000" STRING "stm32cubef2 ubidrv uart safety poll interval of blocked waits (0: no poll)")
+set_cache_default(STM32CUBEF2__UBIDRV_UART_FILE_NUM "2" STRING "stm32cubef2 ubidrv uart number of ports (/dev/tty1 ~ /dev/tty6)")
+set_cache_default(STM32CUBEF2__UBIDRV_UART_READ_BUFFER_SIZE "512" STRING "stm32cubef2 ubidrv uart default read buffer size (power of two)")
+set_cache_default(STM32CUBEF2__UBIDRV_UART_WRITE_BUFFER_SIZE "1024 * 8" STRING "stm32cubef2 ubidrv uart default write buffer size (power of two)")
+set_cache_default(STM32CUBEF2__UBIDRV_UART_RX_DMA_BUFFER_SIZE "256" STRING "stm32cubef2 ubidrv uart circular dma receive buffer size")
+set_cache_default(STM32CUBEF2__UBIDRV_UART_STATS_ENABLE TRUE BOOL "stm32cubef2 ubidrv uart per port statistics (ubidrv_uart_get_stats)")
+
+set_cache_default(STM32CUBEF2__UBIDRV_NVMEM_VOLTAGE_RANGE "3" STRING "stm32cubef2 ubidrv nvmem flash voltage range (1: 1.8V ~ 2.1V, 2: 2.1V ~ 2.7V, 3: 2.7V ~ 3.6V, 4: 2.7V ~ 3.6V with external Vpp)")
+set_cache_default(STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_SIZE "0" STRING "stm32cubef2 ubidrv nvmem widest flash program size in bytes (1, 2, 4 or 8, 0: widest of the voltage range)")
+set_cache_default(STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_CHUNK_SIZE "16" STRING "stm32cubef2 ubidrv nvmem bytes programmed per interrupt disabled window")
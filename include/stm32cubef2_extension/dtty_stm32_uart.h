@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2022 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STM32CUBEF2_EXTENSION_DTTY_STM32_UART_H_
+#define STM32CUBEF2_EXTENSION_DTTY_STM32_UART_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*!
+ * @file dtty_stm32_uart.h
+ *
+ * @brief stm32cubef2 extension of the dtty console on a uart
+ *
+ * With STM32CUBEF2__DTTY_STM32_UART_LOG_BUFFER_SIZE set, dtty_putc and dtty_putn also work from an isr or
+ * a critical section: the output is queued without locking and written later by the console writer task.
+ * Output that does not fit in the buffer is dropped and counted in _g_dtty_uart_log_drop_count.
+ *
+ * Boards without the ubidrv uart driver use the plain HAL interrupt console instead, which has no
+ * log buffer: there dtty output is written by the caller and refused from an isr or a critical section.
+ */
+
+#include <ubinos.h>
+
+/*! Receive complete callback of the console uart (forwarded by the application from the STM32 HAL) */
+void dtty_stm32_uart_rx_callback(void);
+
+/*! Transmit complete callback of the console uart (forwarded by the application from the STM32 HAL) */
+void dtty_stm32_uart_tx_callback(void);
+
+/*! Error callback of the console uart (forwarded by the application from the STM32 HAL) */
+void dtty_stm32_uart_err_callback(void);
+
+/*!
+ * Switch the console to crash-time output
+ *
+ * Writes out the queued output, then makes dtty_putc, dtty_putn and dtty_flush write synchronously
+ * by polling the uart from any context, without locks or kernel services. Meant for fault handlers and
+ * assertion failures; there is no way back.
+ */
+void dtty_stm32_uart_panic(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32CUBEF2_EXTENSION_DTTY_STM32_UART_H_ */
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2022 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STM32CUBEF2_EXTENSION_UBIDRV_NVMEM_H_
+#define STM32CUBEF2_EXTENSION_UBIDRV_NVMEM_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*!
+ * @file nvmem.h
+ *
+ * @brief stm32cubef2 extension of the ubidrv nvmem driver
+ */
+
+#include <ubinos.h>
+
+#include <ubinos/ubidrv/nvmem.h>
+
+#include <stm32cubef2_extension/ubidrv/nvmem_kv.h>
+
+/*!
+ * How nvmem_update got each sector it touched up to date, and how long programming kept interrupts disabled
+ *
+ * Times are in DWT cycles (SystemCoreClock per second).
+ */
+typedef struct _nvmem_stats_t
+{
+    uint32_t unchanged_count;       /*!< Sectors whose flash already held the new contents (nothing written) */
+    uint32_t program_count;         /*!< Sectors whose new contents only cleared bits (changed words programmed in place) */
+    uint32_t erase_count;           /*!< Sectors that needed a 0 to 1 transition (erased and rewritten) */
+    uint32_t irq_off_cycles_max;    /*!< Longest interrupt disabled window of any flash write (STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_CHUNK_SIZE bytes at most) */
+} nvmem_stats_t;
+
+/*! Bytes gathered by nvmem_stream_append per program call */
+#define NVMEM_STREAM_CHUNK_SIZE         256
+
+#define NVMEM_STREAM_STATE_OPEN         1   /*!< Accepting data */
+#define NVMEM_STREAM_STATE_DONE         2   /*!< Finalized */
+#define NVMEM_STREAM_STATE_ERROR        3   /*!< Failed to erase or program */
+
+/*! Streaming writer of a flash region (see nvmem_stream_open) */
+typedef struct _nvmem_stream_t
+{
+    uint32_t start;         /*!< Start of the region */
+    uint32_t end;           /*!< End of the region */
+    uint32_t pos;           /*!< Next address to program */
+    uint32_t erased_end;    /*!< End of the sectors erased so far */
+    uint32_t crc;           /*!< CRC32 of the data appended so far */
+    uint8_t pending[4];     /*!< Trailing bytes that do not make a word yet */
+    uint32_t pending_len;   /*!< Number of bytes in pending */
+    int state;              /*!< NVMEM_STREAM_STATE_* */
+} nvmem_stream_t;
+
+/*! Flash backend of nvmem_kv_t on the internal flash (sector_addr entries are sector start addresses) */
+extern const nvmem_kv_flash_ops_t nvmem_kv_internal_flash_ops;
+
+/*!
+ * Take a snapshot of the nvmem_update statistics
+ *
+ * @param stats     Pointer to store the statistics
+ * @param reset     Clear the statistics after taking the snapshot when not 0
+ *
+ * @return  Result
+ */
+ubi_err_t nvmem_get_stats(nvmem_stats_t *stats, int reset);
+
+/*!
+ * Start writing a flash region as a stream (e.g. a firmware image)
+ *
+ * Unlike nvmem_update, a stream needs no sector-sized buffer and works on sectors of any size:
+ * each sector is erased once when the stream first reaches it, and appended data is programmed as it comes.
+ * Nothing is read back until nvmem_stream_finalize.
+ *
+ * @param stream    Stream to initialize
+ * @param addr      Start of the region (the start of a sector)
+ * @param size      Size of the region (the region has to end at the end of a sector)
+ *
+ * @return  Result (UBI_ERR_PARAM when the region does not cover whole sectors or is out of the flash)
+ */
+ubi_err_t nvmem_stream_open(nvmem_stream_t *stream, uint8_t *addr, size_t size);
+
+/*!
+ * Append data to a stream
+ *
+ * @param stream    Stream
+ * @param buf       Data (no alignment constraint)
+ * @param len       Length of the data
+ *
+ * @return  Result (UBI_ERR_BUF_FULL when the data goes beyond the region, UBI_ERR_INTERNAL when erase or program failed)
+ */
+ubi_err_t nvmem_stream_append(nvmem_stream_t *stream, const uint8_t *buf, size_t len);
+
+/*!
+ * Finish a stream
+ *
+ * Programs the last partial word (padded with 0xFF) and checks the CRC32 of the flash contents against
+ * the CRC32 of the appended data.
+ *
+ * @param stream    Stream
+ * @param crc       Pointer to store the CRC32 of the appended data (can be NULL), to compare with the image's own
+ *
+ * @return  Result (UBI_ERR_INTERNAL when the flash does not hold the appended data)
+ */
+ubi_err_t nvmem_stream_finalize(nvmem_stream_t *stream, uint32_t *crc);
+
+/*!
+ * Update a CRC32 (IEEE 802.3, reflected, as in zlib)
+ *
+ * Start with crc 0 and pass the result of the previous call to continue.
+ *
+ * @param crc   CRC of the data so far
+ * @param data  Data
+ * @param len   Length of the data
+ *
+ * @return  CRC of the data so far followed by data
+ */
+uint32_t nvmem_crc32(uint32_t crc, const void * data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32CUBEF2_EXTENSION_UBIDRV_NVMEM_H_ */
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2022 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STM32CUBEF2_EXTENSION_UBIDRV_NVMEM_KV_H_
+#define STM32CUBEF2_EXTENSION_UBIDRV_NVMEM_KV_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*!
+ * @file nvmem_kv.h
+ *
+ * @brief Log-structured key/value store on flash sectors
+ *
+ * Records are appended to two or more equally sized sectors used as a circular log, so an update programs
+ * only the new record instead of erasing a whole sector. One sector is always kept erased: when the log
+ * reaches it, the live records of the oldest sector are copied into it and the oldest sector is erased
+ * (garbage collection), which also spreads the erases over all the sectors. Sets keep a little room at
+ * the end of every sector free for the end mark of a garbage collection and for a delete, so a collection
+ * always completes and a full store can still free space by deleting keys.
+ *
+ * Each record carries a sequence number and a CRC32, and its size is programmed first, so a record torn by
+ * a power loss is skipped on the next open, as is an unfinished garbage collection.
+ * A RAM hash index from keys to record addresses gives O(1) lookups.
+ *
+ * The flash is accessed only through nvmem_kv_flash_ops_t, so the store can run on another backend
+ * (e.g. a RAM flash model) as well. Calls on one store must be serialized by the caller.
+ */
+
+#include <ubinos.h>
+
+/*! Maximum number of sectors of a store */
+#define NVMEM_KV_SECTOR_NUM_MAX     8
+
+/*! Maximum length of a key in bytes */
+#define NVMEM_KV_KEY_MAX            64
+
+/*! Flash backend of a store */
+typedef struct _nvmem_kv_flash_ops_t
+{
+    /*! Read len bytes at addr */
+    ubi_err_t (*read)(void * ctx, uint32_t addr, void * buf, uint32_t len);
+    /*! Program len bytes (a multiple of 4) at addr (a multiple of 4), which only clears bits */
+    ubi_err_t (*program)(void * ctx, uint32_t addr, const uint32_t * data, uint32_t len);
+    /*! Erase the sector of size bytes at addr to all ones */
+    ubi_err_t (*erase)(void * ctx, uint32_t addr, uint32_t size);
+    /*! User data passed to the functions */
+    void * ctx;
+} nvmem_kv_flash_ops_t;
+
+/*! Entry of the RAM index (private) */
+typedef struct _nvmem_kv_index_entry_t
+{
+    uint32_t hash;
+    uint32_t addr;
+} nvmem_kv_index_entry_t;
+
+/*! Key/value store */
+typedef struct _nvmem_kv_t
+{
+    const nvmem_kv_flash_ops_t * ops;               /*!< Flash backend */
+    uint32_t sector_num;                            /*!< Number of sectors (2 ~ NVMEM_KV_SECTOR_NUM_MAX) */
+    uint32_t sector_addr[NVMEM_KV_SECTOR_NUM_MAX];  /*!< Start address of each sector */
+    uint32_t sector_size;                           /*!< Size of every sector */
+    uint32_t index_size;                            /*!< Number of index entries (a power of two larger than the number of keys) */
+
+    uint32_t sector_gen[NVMEM_KV_SECTOR_NUM_MAX];   /*!< Private (generation of each sector, 0 when erased) */
+    uint32_t active;                                /*!< Private */
+    uint32_t write_addr;                            /*!< Private */
+    uint32_t seq;                                   /*!< Private */
+    uint32_t count;                                 /*!< Private */
+    nvmem_kv_index_entry_t * index;                 /*!< Private */
+    uint32_t gc_count;                              /*!< Number of garbage collections since open */
+} nvmem_kv_t;
+
+/*!
+ * Open a store
+ *
+ * Scans the sectors, finishes or rolls back an interrupted garbage collection, erases sectors with a torn header
+ * and builds the index. Erased flash opens as an empty store.
+ *
+ * @param kv    Store with ops, sector_num, sector_addr, sector_size and index_size set
+ *
+ * @return  Result (UBI_ERR_PARAM for a bad configuration, UBI_ERR_NO_MEM when the index does not fit)
+ */
+ubi_err_t nvmem_kv_open(nvmem_kv_t * kv);
+
+/*!
+ * Close a store and free its index
+ *
+ * @param kv    Store
+ *
+ * @return  Result
+ */
+ubi_err_t nvmem_kv_close(nvmem_kv_t * kv);
+
+/*!
+ * Get the value of a key
+ *
+ * @param kv    Store
+ * @param key   Key (a string)
+ * @param buf   Buffer to store the value
+ * @param size  Size of buf
+ * @param len   Pointer to store the length of the value (can be NULL)
+ *
+ * @return  Result (UBI_ERR_NOT_FOUND when there is no such key, UBI_ERR_BUF_FULL when buf is too small)
+ */
+ubi_err_t nvmem_kv_get(nvmem_kv_t * kv, const char * key, void * buf, uint32_t size, uint32_t * len);
+
+/*!
+ * Set the value of a key
+ *
+ * @param kv    Store
+ * @param key   Key (a string of up to NVMEM_KV_KEY_MAX bytes)
+ * @param value Value
+ * @param len   Length of the value
+ *
+ * @return  Result (UBI_ERR_BUF_FULL when the live records do not fit in the store)
+ */
+ubi_err_t nvmem_kv_set(nvmem_kv_t * kv, const char * key, const void * value, uint32_t len);
+
+/*!
+ * Delete a key
+ *
+ * @param kv    Store
+ * @param key   Key
+ *
+ * @return  Result (UBI_ERR_NOT_FOUND when there is no such key)
+ */
+ubi_err_t nvmem_kv_delete(nvmem_kv_t * kv, const char * key);
+
+/*!
+ * Compact the oldest sector now
+ *
+ * Garbage collection otherwise runs when a write reaches the erased sector.
+ *
+ * @param kv    Store
+ *
+ * @return  Result
+ */
+ubi_err_t nvmem_kv_gc(nvmem_kv_t * kv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32CUBEF2_EXTENSION_UBIDRV_NVMEM_KV_H_ */
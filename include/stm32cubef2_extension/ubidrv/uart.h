@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2022 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STM32CUBEF2_EXTENSION_UBIDRV_UART_H_
+#define STM32CUBEF2_EXTENSION_UBIDRV_UART_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*!
+ * @file uart.h
+ *
+ * @brief stm32cubef2 extension of the ubidrv uart driver
+ *
+ * Declares port options that ubidrv_uart_t does not carry, and the callbacks
+ * the application forwards from the STM32 HAL.
+ */
+
+#include <ubinos.h>
+
+#include <ubinos/ubidrv/uart.h>
+
+/*! File name of the port the dtty console runs on (when STM32CUBEF2__DTTY_STM32_UART_ENABLE is on) */
+#define UBIDRV_UART_CONSOLE_FILE_NAME "/dev/console"
+
+/*! Size of caller-owned storage for a read or write buffer of size bytes */
+#define UBIDRV_UART_BUFFER_STORAGE_SIZE(size) (size)
+
+/*! Number of buckets of the wake-up latency histogram of ubidrv_uart_stats_t */
+#define UBIDRV_UART_STATS_HIST_SIZE 24
+
+/*! Poll event: the read buffer has data */
+#define UBIDRV_UART_POLL_IN     0x0001
+/*! Poll event: the write buffer has free space */
+#define UBIDRV_UART_POLL_OUT    0x0002
+/*! Poll event: the port had an error and is reset by its next read or write (always reported) */
+#define UBIDRV_UART_POLL_ERR    0x0004
+
+/*! Receive engine of a port */
+typedef enum
+{
+    UBIDRV_UART_RX_MODE_IT = 0,     /*!< One interrupt per received byte */
+    UBIDRV_UART_RX_MODE_DMA,        /*!< Circular DMA with half/full transfer and IDLE line events */
+} ubidrv_uart_rx_mode_t;
+
+/*! Transmit engine of a port */
+typedef enum
+{
+    UBIDRV_UART_TX_MODE_IT = 0,     /*!< One interrupt per transmitted byte */
+    UBIDRV_UART_TX_MODE_DMA,        /*!< DMA burst of the contiguous part of the write buffer */
+} ubidrv_uart_tx_mode_t;
+
+/*! Receive flow control of a port */
+typedef enum
+{
+    UBIDRV_UART_RX_FLOW_NONE = 0,   /*!< Bytes received while the read buffer is full are dropped */
+    UBIDRV_UART_RX_FLOW_RTS,        /*!< RTS pin driven as a GPIO by the read buffer level */
+    UBIDRV_UART_RX_FLOW_XONXOFF,    /*!< XOFF/XON sent by the read buffer level, and XOFF/XON received pause/resume transmission */
+} ubidrv_uart_rx_flow_t;
+
+/*! Line terminator of ubidrv_uart_getline */
+typedef enum
+{
+    UBIDRV_UART_LINE_TERM_ANY = 0,  /*!< Any of '\r', '\n' or '\0' (same as ubidrv_uart_gets) */
+    UBIDRV_UART_LINE_TERM_CR,       /*!< '\r' */
+    UBIDRV_UART_LINE_TERM_LF,       /*!< '\n' */
+    UBIDRV_UART_LINE_TERM_CRLF,     /*!< '\r' followed by '\n' */
+} ubidrv_uart_line_term_t;
+
+/*! Extended open options of a port */
+typedef struct _ubidrv_uart_ext_t
+{
+    uint32_t read_buffer_size;          /*!< Size of the read buffer (a power of two) */
+    uint32_t write_buffer_size;         /*!< Size of the write buffer (a power of two) */
+    uint8_t * read_buffer;              /*!< Caller-owned storage of UBIDRV_UART_BUFFER_STORAGE_SIZE(read_buffer_size) bytes (NULL to allocate from heap) */
+    uint8_t * write_buffer;             /*!< Caller-owned storage of UBIDRV_UART_BUFFER_STORAGE_SIZE(write_buffer_size) bytes (NULL to allocate from heap) */
+    ubidrv_uart_rx_mode_t rx_mode;      /*!< Receive engine */
+    uint16_t rx_dma_buffer_size;        /*!< Size of the circular DMA receive buffer */
+    ubidrv_uart_tx_mode_t tx_mode;      /*!< Transmit engine (UBIDRV_UART_TX_MODE_DMA needs hdmatx linked) */
+    uint32_t irq_priority;              /*!< NVIC preemption priority of the port interrupt */
+    ubidrv_uart_rx_flow_t rx_flow;      /*!< Receive flow control */
+    uint32_t rx_flow_high;              /*!< Read buffer level to stop the sender at (0 for 3/4 of read_buffer_size) */
+    uint32_t rx_flow_low;               /*!< Read buffer level to resume the sender at (0 for 1/4 of read_buffer_size) */
+    void * rts_port;                    /*!< GPIO port (GPIO_TypeDef *) of the RTS pin for UBIDRV_UART_RX_FLOW_RTS */
+    uint16_t rts_pin;                   /*!< GPIO pin of the RTS pin for UBIDRV_UART_RX_FLOW_RTS */
+    void * hal_uart;                    /*!< HAL handle (UART_HandleTypeDef *) to use instead of the driver's own, for a port whose interrupt handler uses an existing handle (NULL for the driver's own) */
+} ubidrv_uart_ext_t;
+
+/*! Port and events of ubidrv_uart_poll */
+typedef struct _ubidrv_uart_pollfd_t
+{
+    int fd;                             /*!< File descriptor of the port */
+    uint16_t events;                    /*!< Events of interest (UBIDRV_UART_POLL_IN, UBIDRV_UART_POLL_OUT) */
+    uint16_t revents;                   /*!< Events that are ready (set by ubidrv_uart_poll) */
+} ubidrv_uart_pollfd_t;
+
+/*!
+ * Statistics of a port
+ *
+ * Times are in DWT cycles (SystemCoreClock per second).
+ */
+typedef struct _ubidrv_uart_stats_t
+{
+    uint32_t rx_bytes;                  /*!< Bytes stored in the read buffer */
+    uint32_t tx_bytes;                  /*!< Bytes transmitted from the write buffer */
+    uint32_t rx_isr_count;              /*!< Receive complete and receive event callbacks */
+    uint32_t tx_isr_count;              /*!< Transmit complete callbacks */
+    uint32_t err_isr_count;             /*!< Error callbacks */
+    uint32_t err_overrun_count;         /*!< Errors with HAL_UART_ERROR_ORE */
+    uint32_t err_framing_count;         /*!< Errors with HAL_UART_ERROR_FE */
+    uint32_t err_noise_count;           /*!< Errors with HAL_UART_ERROR_NE */
+    uint32_t err_parity_count;          /*!< Errors with HAL_UART_ERROR_PE */
+    uint32_t err_dma_count;             /*!< Errors with HAL_UART_ERROR_DMA */
+    uint32_t rx_overflow_count;         /*!< Received bytes dropped on a full read buffer */
+    uint32_t tx_overflow_count;         /*!< Writes that did not fit in the write buffer */
+    uint32_t reset_count;               /*!< Peripheral resets after errors */
+    uint32_t read_buffer_high;          /*!< Highest level of the read buffer */
+    uint32_t write_buffer_high;         /*!< Highest level of the write buffer */
+    uint32_t read_wait_count;           /*!< Times a reader slept until signalled or timed out */
+    uint32_t write_wait_count;          /*!< Times a writer (flush) slept */
+    uint64_t read_wait_cycles;          /*!< Total time readers slept */
+    uint64_t write_wait_cycles;         /*!< Total time writers slept */
+    uint32_t wakeup_hist[UBIDRV_UART_STATS_HIST_SIZE]; /*!< Time from the isr signalling a reader to the reader running; bucket n counts [2^(n-1), 2^n) cycles, the last one everything above */
+} ubidrv_uart_stats_t;
+
+/*!
+ * Fill extended open options with default values
+ *
+ * @param ext   Pointer to the extended open options
+ */
+void ubidrv_uart_ext_init(ubidrv_uart_ext_t * ext);
+
+/*!
+ * Open a uart port with extended options
+ *
+ * With UBIDRV_UART_RX_FLOW_RTS, the RTS pin is taken over from the uart peripheral and driven as a GPIO output
+ * (low to let the sender send), so hw_flow_ctl of uart only keeps its CTS part. rx_flow_high should leave room for
+ * what the sender sends after it is stopped (its transmit FIFO, and half of rx_dma_buffer_size in UBIDRV_UART_RX_MODE_DMA).
+ * With UBIDRV_UART_RX_FLOW_XONXOFF, received XON (0x11) and XOFF (0x13) bytes are taken as flow control
+ * and not stored, so the port cannot carry binary data.
+ *
+ * @param uart  Pointer to the uart description (fd is set on success)
+ * @param ext   Pointer to the extended open options (NULL for defaults)
+ *
+ * @return  Result status
+ */
+ubi_st_t ubidrv_uart_open_ext(ubidrv_uart_t * uart, const ubidrv_uart_ext_t * ext);
+
+/*!
+ * Receive event callback
+ *
+ * To be called from HAL_UARTEx_RxEventCallback for ports opened with UBIDRV_UART_RX_MODE_DMA.
+ * The port must have a circular mode DMA stream linked to its receive path (hdmarx).
+ * Whether the event ends a burst is taken from HAL_UARTEx_GetRxEventType, so the HAL must report receive event types.
+ *
+ * @param fd    File descriptor of the port
+ * @param size  Position of the DMA write pointer in the receive buffer reported by the HAL
+ */
+void ubidrv_uart_rx_event_callback(int fd, uint16_t size);
+
+/*!
+ * Read a line
+ *
+ * The terminator is consumed and not stored. The line is stored null terminated and truncated to max - 1 characters.
+ * Received characters are echoed as they are taken when echo is set.
+ *
+ * @param fd    File descriptor of the port
+ * @param str   Buffer to store the line
+ * @param max   Size of the buffer (must be greater than 0)
+ * @param term  Line terminator
+ * @param len   Pointer to store the length of the line (can be NULL)
+ *
+ * @return  Result status
+ */
+ubi_st_t ubidrv_uart_getline(int fd, char *str, uint32_t max, ubidrv_uart_line_term_t term, uint32_t *len);
+
+/*!
+ * Read a line with timeout
+ *
+ * On UBI_ST_TIMEOUT, the characters received so far are stored in str and len, and are consumed.
+ *
+ * @param fd                File descriptor of the port
+ * @param str               Buffer to store the line
+ * @param max               Size of the buffer (must be greater than 0)
+ * @param term              Line terminator
+ * @param len               Pointer to store the length of the line (can be NULL)
+ * @param timeoutms         Timeout in milliseconds
+ * @param remain_timeoutms  Pointer to store the remaining timeout (can be NULL)
+ *
+ * @return  Result status
+ */
+ubi_st_t ubidrv_uart_getline_timedms(int fd, char *str, uint32_t max, ubidrv_uart_line_term_t term, uint32_t *len, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+/*!
+ * Set when a blocked reader of ubidrv_uart_io_read or ubidrv_uart_io_read_acquire is woken up (like VMIN/VTIME of termios)
+ *
+ * The reader is woken up once threshold bytes (or the rest of the requested length if smaller) are received.
+ * When timeoutms is not 0, a reader that has got at least one byte also returns with UBI_ST_OK once no byte is
+ * received for timeoutms; the read length then tells how much was received. In UBIDRV_UART_RX_MODE_DMA,
+ * an IDLE line also wakes the reader up. Character reads (getc, gets, getline) are not affected.
+ * The default is threshold 1 and timeoutms 0.
+ *
+ * @param fd            File descriptor of the port
+ * @param threshold     Number of bytes to wake up the reader (1 to the read buffer size)
+ * @param timeoutms     Inter-byte timeout in milliseconds (0 for none)
+ *
+ * @return  Result status
+ */
+ubi_st_t ubidrv_uart_setrxwake(int fd, uint32_t threshold, uint32_t timeoutms);
+
+/*!
+ * Wait until any of several ports is ready
+ *
+ * Sleeps on a single wait object that the isr callbacks of the polled ports signal, instead of
+ * checking each port in turn. Only one task can poll at a time.
+ *
+ * @param fds       Array of ports and events of interest (revents is set for each)
+ * @param nfds      Number of entries of fds
+ * @param nready    Pointer to store the number of entries with revents set (can be NULL)
+ *
+ * @return  Result status (UBI_ST_BUSY when another task is polling)
+ */
+ubi_st_t ubidrv_uart_poll(ubidrv_uart_pollfd_t * fds, uint32_t nfds, uint32_t * nready);
+
+/*!
+ * Wait until any of several ports is ready, with timeout
+ *
+ * A timeoutms of 0 only checks the ports.
+ *
+ * @see ubidrv_uart_poll
+ *
+ * @return  Result status (UBI_ST_TIMEOUT when no port got ready)
+ */
+ubi_st_t ubidrv_uart_poll_timedms(ubidrv_uart_pollfd_t * fds, uint32_t nfds, uint32_t * nready, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+/*!
+ * Write synchronously by polling the transmitter, bypassing the write buffer
+ *
+ * Meant for crash-time output: it takes no lock, calls no kernel service and works from an isr or
+ * with interrupts disabled. The first call stops the transmit engine and sends what is left in the write buffer,
+ * and the port is reset by its next normal read or write.
+ *
+ * @param fd        File descriptor of the port
+ * @param data      Data to write
+ * @param len       Length of the data
+ *
+ * @return  Result status (UBI_ST_ERR_IO when the transmitter does not get ready)
+ */
+ubi_st_t ubidrv_uart_write_polled(int fd, const uint8_t * data, uint32_t len);
+
+/*!
+ * Take a snapshot of the statistics of a port
+ *
+ * @param fd        File descriptor of the port
+ * @param stats     Pointer to store the statistics
+ * @param reset     Clear the statistics after taking the snapshot when not 0
+ *
+ * @return  Result status (UBI_ST_ERR_NOT_SUPPORTED when STM32CUBEF2__UBIDRV_UART_STATS_ENABLE is off)
+ */
+ubi_st_t ubidrv_uart_get_stats(int fd, ubidrv_uart_stats_t * stats, int reset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32CUBEF2_EXTENSION_UBIDRV_UART_H_ */
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2022 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef STM32CUBEF2_EXTENSION_UBIDRV_UART_IO_H_
+#define STM32CUBEF2_EXTENSION_UBIDRV_UART_IO_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*!
+ * @file uart_io.h
+ *
+ * @brief stm32cubef2 extension of the ubidrv uart io interface
+ *
+ * In this port, ubidrv_uart_io_write queues what fits in the write buffer and returns UBI_ST_ERR_BUF_FULL for the rest,
+ * while ubidrv_uart_io_write_timedms waits for transmission to free space until everything is queued, and returns
+ * UBI_ST_TIMEOUT with the number of bytes queued so far when the timeout expires first.
+ */
+
+#include <ubinos.h>
+
+#include <ubinos/ubidrv/uart_io.h>
+
+/*! Region of a buffer */
+typedef struct _ubidrv_uart_io_vec_t
+{
+    uint8_t * buf;      /*!< Start of the region */
+    uint32_t len;       /*!< Length of the region in bytes */
+} ubidrv_uart_io_vec_t;
+
+typedef struct _ubidrv_uart_io_async_t ubidrv_uart_io_async_t;
+
+/*! Completion callback of an asynchronous request */
+typedef void (*ubidrv_uart_io_async_callback_t)(ubidrv_uart_io_async_t * async);
+
+/*! Asynchronous read or write request (owned by the driver from submission until completion or cancel) */
+struct _ubidrv_uart_io_async_t
+{
+    int fd;                                     /*!< File descriptor of the port */
+    uint8_t * buf;                              /*!< Buffer to read into or write from */
+    uint32_t len;                               /*!< Length of the buffer */
+    ubidrv_uart_io_async_callback_t callback;   /*!< Called on completion (can be NULL) */
+    sem_pt sem;                                 /*!< Given on completion, after the callback (can be NULL) */
+    void * arg;                                 /*!< User data for the callback */
+
+    uint32_t done;                              /*!< Number of bytes transferred (set by the driver) */
+    ubi_st_t status;                            /*!< Result (set by the driver; UBI_ST_BUSY while queued) */
+
+    struct _ubidrv_uart_io_async_t * next;      /*!< Private */
+    int write;                                  /*!< Private */
+};
+
+/*!
+ * Read into several regions
+ *
+ * Behaves like ubidrv_uart_io_read on the concatenation of the regions: they are filled in order, and the call returns
+ * once all of them are full (or as set by ubidrv_uart_setrxwake).
+ *
+ * @param fd        File descriptor of the port
+ * @param vec       Array of regions to store the received data
+ * @param count     Number of regions
+ * @param read      Pointer to store the total number of bytes read (can be NULL)
+ *
+ * @return  Result status
+ */
+ubi_st_t ubidrv_uart_io_readv(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *read);
+
+/*!
+ * Read into several regions with timeout
+ *
+ * @see ubidrv_uart_io_readv
+ */
+ubi_st_t ubidrv_uart_io_readv_timedms(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *read, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+/*!
+ * Write several regions as one unit
+ *
+ * The regions are put in the write buffer back to back under a single hold of the write lock, so no other writer
+ * can interleave with them, and transmission is started at most once. Unlike ubidrv_uart_io_write, nothing is written
+ * when the whole of the regions does not fit in the write buffer.
+ *
+ * @param fd        File descriptor of the port
+ * @param vec       Array of regions to write
+ * @param count     Number of regions
+ * @param written   Pointer to store the total number of bytes written (can be NULL)
+ *
+ * @return  Result status (UBI_ST_ERR_BUF_FULL when the regions do not fit in the free space)
+ */
+ubi_st_t ubidrv_uart_io_writev(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *written);
+
+/*!
+ * Write several regions as one unit, with timeout
+ *
+ * Waits up to timeoutms for the write lock and then for the write buffer to drain until all of the regions fit.
+ * UBI_ST_ERR_BUF_FULL is returned right away when they are larger than the write buffer.
+ *
+ * @see ubidrv_uart_io_writev
+ */
+ubi_st_t ubidrv_uart_io_writev_timedms(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *written, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+/*!
+ * Queue an asynchronous read
+ *
+ * Requests of a port complete in submission order. A read completes once buf is full, or once
+ * the rx wake threshold of ubidrv_uart_setrxwake is reached (any received data by default).
+ * Completions are delivered by ubidrv_uart_io_async_process, never from the isr.
+ *
+ * @param async     Request with fd, buf, len and the completion callback and/or sem set
+ *
+ * @return  Result status
+ */
+ubi_st_t ubidrv_uart_io_read_async(ubidrv_uart_io_async_t * async);
+
+/*!
+ * Queue an asynchronous write
+ *
+ * A write completes once all of buf is queued in the write buffer (use ubidrv_uart_io_flush to wait for the wire).
+ *
+ * @see ubidrv_uart_io_read_async
+ */
+ubi_st_t ubidrv_uart_io_write_async(ubidrv_uart_io_async_t * async);
+
+/*!
+ * Remove a queued asynchronous request without completing it
+ *
+ * On success, the callback is not called, status is set to UBI_ST_TIMEOUT and done tells how much was transferred.
+ *
+ * @param async     Request to cancel
+ *
+ * @return  Result status (UBI_ST_ERR_NOT_FOUND when the request has already completed)
+ */
+ubi_st_t ubidrv_uart_io_async_cancel(ubidrv_uart_io_async_t * async);
+
+/*!
+ * Move data for the queued asynchronous requests of all ports and deliver their completions
+ *
+ * Meant to be called by one service task, typically in a loop with ubidrv_uart_io_async_wait_timedms.
+ * Callbacks run in the calling task and may submit new requests.
+ *
+ * @return  Number of completed requests
+ */
+int ubidrv_uart_io_async_process(void);
+
+/*!
+ * Wait until a port with queued asynchronous requests can make progress
+ *
+ * @param timeoutms     Timeout in milliseconds
+ *
+ * @return  Result status (UBI_ST_TIMEOUT when nothing happened)
+ */
+ubi_st_t ubidrv_uart_io_async_wait_timedms(uint32_t timeoutms);
+
+/*!
+ * Borrow the received data in the read buffer without copying
+ *
+ * Waits until at least one byte is received. The data is returned as up to two regions (the second one covers
+ * the wrap of the read buffer; its length is 0 when unused). On success, the read lock stays held until
+ * ubidrv_uart_io_read_commit is called.
+ *
+ * @param fd        File descriptor of the port
+ * @param vec       Array of two regions to store the received data
+ * @param length    Pointer to store the total length of the regions (can be NULL)
+ *
+ * @return  Result status
+ */
+ubi_st_t ubidrv_uart_io_read_acquire(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length);
+
+/*!
+ * Borrow the received data in the read buffer without copying, with timeout
+ *
+ * @see ubidrv_uart_io_read_acquire
+ */
+ubi_st_t ubidrv_uart_io_read_acquire_timedms(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+/*!
+ * Consume borrowed received data and release the read lock
+ *
+ * @param fd        File descriptor of the port
+ * @param length    Number of bytes consumed from the start of the borrowed regions
+ *
+ * @return  Result status
+ */
+ubi_st_t ubidrv_uart_io_read_commit(int fd, uint32_t length);
+
+/*!
+ * Reserve free space in the write buffer to fill in place
+ *
+ * The free space is returned as up to two regions (the second one covers the wrap of the write buffer; its length is 0
+ * when unused). On success, the write lock stays held until ubidrv_uart_io_write_commit is called.
+ *
+ * @param fd        File descriptor of the port
+ * @param vec       Array of two regions to store the free space
+ * @param length    Pointer to store the total length of the regions (can be NULL)
+ *
+ * @return  Result status (UBI_ST_ERR_BUF_FULL when there is no free space)
+ */
+ubi_st_t ubidrv_uart_io_write_reserve(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length);
+
+/*!
+ * Reserve free space in the write buffer to fill in place, with timeout on the write lock
+ *
+ * @see ubidrv_uart_io_write_reserve
+ */
+ubi_st_t ubidrv_uart_io_write_reserve_timedms(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length, uint32_t timeoutms, uint32_t *remain_timeoutms);
+
+/*!
+ * Queue the filled part of reserved space for transmission and release the write lock
+ *
+ * @param fd        File descriptor of the port
+ * @param length    Number of bytes filled from the start of the reserved regions
+ *
+ * @return  Result status
+ */
+ubi_st_t ubidrv_uart_io_write_commit(int fd, uint32_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STM32CUBEF2_EXTENSION_UBIDRV_UART_IO_H_ */
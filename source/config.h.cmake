@@ -9,6 +9,20 @@
 
 #define STM32CUBEF2__DTTY_STM32_UART_READ_BUFFER_SIZE (@STM32CUBEF2__DTTY_STM32_UART_READ_BUFFER_SIZE@)
 #define STM32CUBEF2__DTTY_STM32_UART_WRITE_BUFFER_SIZE (@STM32CUBEF2__DTTY_STM32_UART_WRITE_BUFFER_SIZE@)
+#define STM32CUBEF2__DTTY_STM32_UART_BAUD_RATE (@STM32CUBEF2__DTTY_STM32_UART_BAUD_RATE@)
+#define STM32CUBEF2__DTTY_STM32_UART_LOG_BUFFER_SIZE (@STM32CUBEF2__DTTY_STM32_UART_LOG_BUFFER_SIZE@)
+#cmakedefine01 STM32CUBEF2__DTTY_STM32_UART_NEWLIB_WRITE
+
+#define STM32CUBEF2__UBIDRV_UART_CHECK_INTERVAL_MS (@STM32CUBEF2__UBIDRV_UART_CHECK_INTERVAL_MS@)
+#define STM32CUBEF2__UBIDRV_UART_FILE_NUM (@STM32CUBEF2__UBIDRV_UART_FILE_NUM@)
+#define STM32CUBEF2__UBIDRV_UART_READ_BUFFER_SIZE (@STM32CUBEF2__UBIDRV_UART_READ_BUFFER_SIZE@)
+#define STM32CUBEF2__UBIDRV_UART_WRITE_BUFFER_SIZE (@STM32CUBEF2__UBIDRV_UART_WRITE_BUFFER_SIZE@)
+#define STM32CUBEF2__UBIDRV_UART_RX_DMA_BUFFER_SIZE (@STM32CUBEF2__UBIDRV_UART_RX_DMA_BUFFER_SIZE@)
+#cmakedefine01 STM32CUBEF2__UBIDRV_UART_STATS_ENABLE
+
+#define STM32CUBEF2__UBIDRV_NVMEM_VOLTAGE_RANGE (@STM32CUBEF2__UBIDRV_NVMEM_VOLTAGE_RANGE@)
+#define STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_SIZE (@STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_SIZE@)
+#define STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_CHUNK_SIZE (@STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_CHUNK_SIZE@)
 
 #endif /* (INCLUDE__STM32CUBEF2_EXTENSION == 1) */
 
@@ -29,6 +29,8 @@
 
 #include "stm32f2xx_hal.h"
 
+#include <stm32cubef2_extension/ubidrv/nvmem.h>
+
 #undef LOGM_CATEGORY
 #define LOGM_CATEGORY LOGM_CATEGORY__NVMEM
 
@@ -38,6 +40,38 @@
 
 #define FLASH_MAX_COPY_BUFFER 16384
 
+/* The voltage range sets the erase parallelism and the widest program size (see 3.5 in RM0033) */
+#if (STM32CUBEF2__UBIDRV_NVMEM_VOLTAGE_RANGE == 1)
+#define FLASH_VOLTAGE_RANGE         FLASH_VOLTAGE_RANGE_1
+#define FLASH_PROGRAM_SIZE_MAX      1
+#elif (STM32CUBEF2__UBIDRV_NVMEM_VOLTAGE_RANGE == 2)
+#define FLASH_VOLTAGE_RANGE         FLASH_VOLTAGE_RANGE_2
+#define FLASH_PROGRAM_SIZE_MAX      2
+#elif (STM32CUBEF2__UBIDRV_NVMEM_VOLTAGE_RANGE == 3)
+#define FLASH_VOLTAGE_RANGE         FLASH_VOLTAGE_RANGE_3
+#define FLASH_PROGRAM_SIZE_MAX      4
+#elif (STM32CUBEF2__UBIDRV_NVMEM_VOLTAGE_RANGE == 4)
+#define FLASH_VOLTAGE_RANGE         FLASH_VOLTAGE_RANGE_4
+#define FLASH_PROGRAM_SIZE_MAX      8
+#else
+#error "Unsupported STM32CUBEF2__UBIDRV_NVMEM_VOLTAGE_RANGE"
+#endif
+
+#if (STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_SIZE == 0)
+#define FLASH_PROGRAM_SIZE          FLASH_PROGRAM_SIZE_MAX
+#elif (STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_SIZE > FLASH_PROGRAM_SIZE_MAX) || \
+        ((STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_SIZE & (STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_SIZE - 1)) != 0)
+#error "STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_SIZE is not supported in STM32CUBEF2__UBIDRV_NVMEM_VOLTAGE_RANGE"
+#else
+#define FLASH_PROGRAM_SIZE          STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_SIZE
+#endif
+
+#define FLASH_PROGRAM_CHUNK_SIZE    STM32CUBEF2__UBIDRV_NVMEM_PROGRAM_CHUNK_SIZE
+
+#define FLASH_UPDATE_UNCHANGED  0
+#define FLASH_UPDATE_PROGRAM    1
+#define FLASH_UPDATE_ERASE      2
+
 /* F217 1 Mbyte single-bank organization. */
 const uint32_t flash_sector_map[] =
 {
@@ -59,8 +93,27 @@ static uint32_t FLASH_Get_Sector(uint32_t Address);
 static uint32_t FLASH_Get_Sector_Size(uint32_t Sector);
 
 static int FLASH_Erase_Size(uint32_t address, uint32_t len_bytes);
-static int FLASH_Write(uint32_t address, uint32_t *pData, uint32_t len_bytes);
+static int FLASH_Write(uint32_t address, const void *pData, uint32_t len_bytes);
+static uint32_t FLASH_Program_Type(uint32_t size);
 static int FLASH_Update(uint32_t dst_addr, const void *data, uint32_t size);
+static int FLASH_Update_Kind(uint32_t dst_addr, const uint8_t *src, uint32_t len);
+static int FLASH_Program_In_Place(uint32_t dst_addr, const uint8_t *src, uint32_t len);
+
+static int FLASH_Stream_Program(nvmem_stream_t *stream, const uint32_t *data, uint32_t len);
+
+static nvmem_stats_t _g_nvmem_stats;
+
+static ubi_err_t _nvmem_kv_internal_read(void *ctx, uint32_t addr, void *buf, uint32_t len);
+static ubi_err_t _nvmem_kv_internal_program(void *ctx, uint32_t addr, const uint32_t *data, uint32_t len);
+static ubi_err_t _nvmem_kv_internal_erase(void *ctx, uint32_t addr, uint32_t size);
+
+const nvmem_kv_flash_ops_t nvmem_kv_internal_flash_ops =
+{
+    .read = _nvmem_kv_internal_read,
+    .program = _nvmem_kv_internal_program,
+    .erase = _nvmem_kv_internal_erase,
+    .ctx = NULL,
+};
 
 ubi_err_t nvmem_erase(uint8_t *addr, size_t size)
 {
@@ -100,6 +153,19 @@ ubi_err_t nvmem_update(uint8_t *addr, const uint8_t *buf, size_t size)
     return ubi_err;
 }
 
+ubi_err_t nvmem_get_stats(nvmem_stats_t *stats, int reset)
+{
+    assert(stats != NULL);
+
+    *stats = _g_nvmem_stats;
+    if (reset)
+    {
+        memset(&_g_nvmem_stats, 0, sizeof(_g_nvmem_stats));
+    }
+
+    return UBI_ERR_OK;
+}
+
 ubi_err_t nvmem_read(const uint8_t *addr, uint8_t *buf, size_t size)
 {
     ubi_err_t ubi_err;
@@ -113,6 +179,181 @@ ubi_err_t nvmem_read(const uint8_t *addr, uint8_t *buf, size_t size)
     return ubi_err;
 }
 
+ubi_err_t nvmem_stream_open(nvmem_stream_t *stream, uint8_t *addr, size_t size)
+{
+    ubi_err_t ubi_err;
+    uint32_t start = (uint32_t) addr;
+    int32_t sector;
+    uint32_t i;
+
+    do
+    {
+        ubi_err = UBI_ERR_PARAM;
+
+        if (stream == NULL || size == 0)
+        {
+            break;
+        }
+
+        /* Sectors are erased as a whole, so the region has to start a sector */
+        sector = (int32_t) FLASH_Get_Sector(start);
+        if (sector < 0 || flash_sector_map[sector] != start ||
+                size > flash_sector_map[sizeof(flash_sector_map) / sizeof(uint32_t) - 1] - start)
+        {
+            break;
+        }
+
+        /* and to end one, so that nothing past it is erased (which also keeps the padded last word inside) */
+        for (i = sector + 1; i < sizeof(flash_sector_map) / sizeof(uint32_t) - 1 && flash_sector_map[i] < start + size; i++)
+        {
+        }
+        if (flash_sector_map[i] != start + size)
+        {
+            break;
+        }
+
+        stream->start = start;
+        stream->end = start + size;
+        stream->pos = start;
+        stream->erased_end = start;
+        stream->crc = 0;
+        stream->pending_len = 0;
+        stream->state = NVMEM_STREAM_STATE_OPEN;
+
+        ubi_err = UBI_ERR_OK;
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_stream_append(nvmem_stream_t *stream, const uint8_t *buf, size_t len)
+{
+    ubi_err_t ubi_err;
+    uint32_t chunk[NVMEM_STREAM_CHUNK_SIZE / 4];
+    uint32_t n;
+
+    do
+    {
+        if (stream == NULL || stream->state != NVMEM_STREAM_STATE_OPEN)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+        if (len > stream->end - stream->pos - stream->pending_len)
+        {
+            ubi_err = UBI_ERR_BUF_FULL;
+            break;
+        }
+
+        stream->crc = nvmem_crc32(stream->crc, buf, len);
+
+        ubi_err = UBI_ERR_OK;
+        while (len > 0)
+        {
+            /* Gather whole words in an aligned chunk, keeping the last partial word for the next call */
+            n = MIN(len, NVMEM_STREAM_CHUNK_SIZE - stream->pending_len);
+            memcpy((uint8_t *) chunk, stream->pending, stream->pending_len);
+            memcpy((uint8_t *) chunk + stream->pending_len, buf, n);
+            buf += n;
+            len -= n;
+            n += stream->pending_len;
+
+            stream->pending_len = n % 4;
+            memcpy(stream->pending, (uint8_t *) chunk + n - stream->pending_len, stream->pending_len);
+            n -= stream->pending_len;
+
+            if (n > 0 && FLASH_Stream_Program(stream, chunk, n) != 0)
+            {
+                stream->state = NVMEM_STREAM_STATE_ERROR;
+                ubi_err = UBI_ERR_INTERNAL;
+                break;
+            }
+        }
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_stream_finalize(nvmem_stream_t *stream, uint32_t *crc)
+{
+    ubi_err_t ubi_err;
+    uint32_t word;
+    uint32_t len;
+
+    do
+    {
+        if (stream == NULL || stream->state != NVMEM_STREAM_STATE_OPEN)
+        {
+            ubi_err = UBI_ERR_INVALID_STATE;
+            break;
+        }
+
+        stream->state = NVMEM_STREAM_STATE_ERROR;
+        ubi_err = UBI_ERR_INTERNAL;
+
+        len = stream->pos - stream->start;
+        if (stream->pending_len > 0)
+        {
+            word = 0xFFFFFFFF;
+            memcpy(&word, stream->pending, stream->pending_len);
+            if (FLASH_Stream_Program(stream, &word, 4) != 0)
+            {
+                break;
+            }
+            len += stream->pending_len;
+            stream->pending_len = 0;
+        }
+
+        /* Read the image back as a whole against what was appended */
+        if (nvmem_crc32(0, (const void *) stream->start, len) != stream->crc)
+        {
+            printf("Error stream at 0x%08lx does not read back\n", stream->start);
+            break;
+        }
+
+        if (crc != NULL)
+        {
+            *crc = stream->crc;
+        }
+
+        stream->state = NVMEM_STREAM_STATE_DONE;
+        ubi_err = UBI_ERR_OK;
+    } while (0);
+
+    return ubi_err;
+}
+
+static ubi_err_t _nvmem_kv_internal_read(void *ctx, uint32_t addr, void *buf, uint32_t len)
+{
+    (void) ctx;
+
+    return nvmem_read((const uint8_t *) addr, (uint8_t *) buf, len);
+}
+
+static ubi_err_t _nvmem_kv_internal_program(void *ctx, uint32_t addr, const uint32_t *data, uint32_t len)
+{
+    (void) ctx;
+
+    /* Unlike FLASH_Update, there is no erase before to leave the flash unlocked */
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR| FLASH_FLAG_PGSERR);
+    HAL_FLASH_Unlock();
+
+    if (FLASH_Write(addr, data, len) != 0)
+    {
+        return UBI_ERR_INTERNAL;
+    }
+
+    return UBI_ERR_OK;
+}
+
+static ubi_err_t _nvmem_kv_internal_erase(void *ctx, uint32_t addr, uint32_t size)
+{
+    (void) ctx;
+
+    return nvmem_erase((uint8_t *) addr, size);
+}
+
 /**
  * @brief  Erase FLASH memory sector(s) at address.
  * @param  In: address     Start address to erase from.
@@ -132,7 +373,7 @@ static int FLASH_Erase_Size(uint32_t address, uint32_t len_bytes)
      * After erase, the flash is left in unlocked state.
      */
     EraseInit.TypeErase = FLASH_TYPEERASE_SECTORS;
-    EraseInit.VoltageRange = FLASH_VOLTAGE_RANGE_3; /* Does not support more than single-word programming. See 3.5.2 in RM0430. */
+    EraseInit.VoltageRange = FLASH_VOLTAGE_RANGE; /* Sets the erase parallelism. See 3.5 in RM0033. */
     EraseInit.Sector = FLASH_Get_Sector(address);
     EraseInit.NbSectors = FLASH_Get_Sector(address + len_bytes - 1) - EraseInit.Sector + 1;
 
@@ -159,45 +400,99 @@ static int FLASH_Erase_Size(uint32_t address, uint32_t len_bytes)
 
 /**
  * @brief  Write to FLASH memory.
- * @param  In: address     Destination address.
- * @param  In: pData       Data to be programmed: Must be 8 byte aligned.
+ * @note   Each program operation uses the widest size (up to FLASH_PROGRAM_SIZE) that the destination
+ *         alignment and the remaining length allow, so unaligned heads and tails are programmed by
+ *         bytes or half-words.
+ * @note   Interrupts are disabled for FLASH_PROGRAM_CHUNK_SIZE bytes at a time and the read back check
+ *         runs with them enabled, so pending interrupts are taken between chunks.
+ * @param  In: address     Destination address (no alignment constraint).
+ * @param  In: pData       Data to be programmed (no alignment constraint).
  * @param  In: len_bytes   Number of bytes to be programmed.
  * @retval  0: Success.
  -1: Failure.
  */
-static int FLASH_Write(uint32_t address, uint32_t *pData, uint32_t len_bytes)
+static int FLASH_Write(uint32_t address, const void *pData, uint32_t len_bytes)
 {
-    int i;
+    const uint8_t *src = (const uint8_t *) pData;
+    HAL_StatusTypeDef status = HAL_OK;
+    uint64_t data;
+    uint32_t size;
+    uint32_t chunk_end;
+    uint32_t primask;
+    uint32_t cycles;
+    uint32_t i;
     int ret = -1;
 
-    __disable_irq();
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 
-    for (i = 0; i < len_bytes; i += 4)
+    i = 0;
+    while ((status == HAL_OK) && (i < len_bytes))
     {
-        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address + i, *(pData + (i / 4))) != HAL_OK)
+        chunk_end = i + MIN(FLASH_PROGRAM_CHUNK_SIZE, len_bytes - i);
+
+        primask = __get_PRIMASK();
+        __disable_irq();
+        cycles = DWT->CYCCNT;
+
+        do
         {
-            break;
-        }
+            size = FLASH_PROGRAM_SIZE;
+            while ((((address + i) & (size - 1)) != 0) || (size > len_bytes - i))
+            {
+                size >>= 1;
+            }
+
+            data = 0;
+            memcpy(&data, src + i, size);
+            status = HAL_FLASH_Program(FLASH_Program_Type(size), address + i, data);
+            i += size;
+        } while ((status == HAL_OK) && (i < chunk_end));
+
+        cycles = DWT->CYCCNT - cycles;
+        _g_nvmem_stats.irq_off_cycles_max = MAX(_g_nvmem_stats.irq_off_cycles_max, cycles);
+        __set_PRIMASK(primask);
     }
 
     /* Memory check */
-    for (i = 0; i < len_bytes; i += 4)
+    for (i = 0; i < len_bytes; i++)
     {
-        uint32_t *dst = (uint32_t*) (address + i);
-        uint32_t *src = ((uint32_t*) pData) + (i / 4);
+        uint8_t *dst = (uint8_t*) (address + i);
 
-        if (*dst != *src)
+        if (*dst != src[i])
         {
-            printf("Write failed @0x%08lx, read value=0x%08lx, expected=0x%08lx\n", (uint32_t) dst, *dst, *src);
+            printf("Write failed @0x%08lx, read value=0x%02x, expected=0x%02x\n", (uint32_t) dst, *dst, src[i]);
             break;
         }
+    }
+    if (i == len_bytes)
+    {
         ret = 0;
     }
-    __enable_irq();
 
     return ret;
 }
 
+/**
+ * @brief  Gives the HAL program type of a program size.
+ * @param  In: size        Program size in bytes (1, 2, 4 or 8).
+ * @retval HAL program type.
+ */
+static uint32_t FLASH_Program_Type(uint32_t size)
+{
+    switch (size)
+    {
+    case 1:
+        return FLASH_TYPEPROGRAM_BYTE;
+    case 2:
+        return FLASH_TYPEPROGRAM_HALFWORD;
+    case 4:
+        return FLASH_TYPEPROGRAM_WORD;
+    default:
+        return FLASH_TYPEPROGRAM_DOUBLEWORD;
+    }
+}
+
 /**
  * @brief  Update a chunk of the FLASH memory.
  * @note   The FLASH chunk must no cross a FLASH bank boundary.
@@ -228,34 +523,63 @@ static int FLASH_Update(uint32_t dst_addr, const void *data, uint32_t size)
         copy_buffer_size = MAX(copy_buffer_size, FLASH_Get_Sector_Size(i));
     }
 
-    /* Allocate and align the sector cache on double-word boundaries, in order to allow double-word page programming. */
     /* Workarround on allocation, we limit the allocation to 4K */
     if (copy_buffer_size > FLASH_MAX_COPY_BUFFER)
     {
         copy_buffer_size = FLASH_MAX_COPY_BUFFER;
     }
-    sector_cache_buffer = malloc(copy_buffer_size + sizeof(uint32_t));
 
-    if (sector_cache_buffer != NULL)
+    do
     {
-        sector_cache = (uint32_t*) ((uint32_t) sector_cache_buffer & ~(sizeof(uint32_t) - 1)) + 1;
+        uint32_t sector = FLASH_Get_Sector(dst_addr);
+        uint32_t sector_size = flash_sector_map[sector + 1] - flash_sector_map[sector];
+        uint32_t fl_addr = flash_sector_map[sector];
+        int fl_offset = dst_addr - fl_addr;
+        int len = MIN(sector_size - fl_offset, remaining);
 
-        do
+        switch (FLASH_Update_Kind(dst_addr, src_addr, len))
         {
-            uint32_t sector = FLASH_Get_Sector(dst_addr);
-            uint32_t sector_size = flash_sector_map[sector + 1] - flash_sector_map[sector];
-            uint32_t fl_addr = flash_sector_map[sector];
-            int fl_offset = dst_addr - fl_addr;
-            int len = MIN(sector_size - fl_offset, remaining);
+        case FLASH_UPDATE_UNCHANGED:
+            _g_nvmem_stats.unchanged_count++;
+            break;
 
+        case FLASH_UPDATE_PROGRAM:
+            /* Only 1 to 0 transitions: program the changed words without erasing */
+            HAL_FLASH_Unlock();
+            ret = FLASH_Program_In_Place(dst_addr, src_addr, len);
+            if (ret != 0)
+            {
+                printf("Error %d programming %d bytes at 0x%08lx\n", ret, len, dst_addr);
+            }
+            else
+            {
+                _g_nvmem_stats.program_count++;
+            }
+            break;
+
+        default:
+            /* The whole sector is erased, so all of it has to fit in the cache (use nvmem_stream_open for larger sectors) */
+            if (sector_size > copy_buffer_size)
+            {
+                printf("Error sector at 0x%08lx is larger than the %d bytes copy buffer\n", fl_addr, copy_buffer_size);
+                ret = -1;
+                break;
+            }
+            /* Only erasing needs the sector cache; allocate and align it on double-word boundaries, in order to allow double-word page programming. */
+            if (sector_cache_buffer == NULL)
+            {
+                sector_cache_buffer = malloc(copy_buffer_size + sizeof(uint32_t));
+                if (sector_cache_buffer == NULL)
+                {
+                    printf("Error allocating the %d bytes copy buffer\n", copy_buffer_size);
+                    ret = -1;
+                    break;
+                }
+                sector_cache = (uint32_t*) ((uint32_t) sector_cache_buffer & ~(sizeof(uint32_t) - 1)) + 1;
+            }
             /* Load from the flash into the cache */
             copy_size = sector_size;
-            if (copy_size > copy_buffer_size)
-                copy_size = copy_buffer_size;
             memcpy(sector_cache, (void*) fl_addr, copy_size);
-            /* allocatd buffer is too small */
-            if (len > copy_size)
-                return rc;
             memcpy((uint8_t*) sector_cache + fl_offset, src_addr, len);
             /* Erase the page, and write the cache */
             ret = FLASH_Erase_Size(fl_addr, sector_size);
@@ -272,22 +596,134 @@ static int FLASH_Update(uint32_t dst_addr, const void *data, uint32_t size)
                 }
                 else
                 {
-                    dst_addr += len;
-                    src_addr += len;
-                    remaining -= len;
+                    ret = 0;
+                    _g_nvmem_stats.erase_count++;
                 }
             }
-        } while ((ret == 0) && (remaining > 0));
+            break;
+        }
+
         if (ret == 0)
         {
-            rc = 0;
+            dst_addr += len;
+            src_addr += len;
+            remaining -= len;
         }
+    } while ((ret == 0) && (remaining > 0));
+    if (ret == 0)
+    {
+        rc = 0;
+    }
 
+    if (sector_cache_buffer != NULL)
+    {
         free(sector_cache_buffer);
     }
     return rc;
 }
 
+/**
+ * @brief  Program the next words of a stream, erasing each sector the first time it is reached.
+ * @param  In: stream      Stream.
+ * @param  In: data        Words to program.
+ * @param  In: len         Number of bytes (a multiple of 4).
+ * @retval  0:  Success.
+ *         -1:  Failure.
+ */
+static int FLASH_Stream_Program(nvmem_stream_t *stream, const uint32_t *data, uint32_t len)
+{
+    uint32_t sector;
+
+    while (stream->erased_end < stream->pos + len)
+    {
+        sector = FLASH_Get_Sector(stream->erased_end);
+        if (FLASH_Erase_Size(flash_sector_map[sector], FLASH_Get_Sector_Size(sector)) != 0)
+        {
+            return -1;
+        }
+        stream->erased_end = flash_sector_map[sector + 1];
+    }
+
+    __HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR| FLASH_FLAG_PGSERR);
+    HAL_FLASH_Unlock();
+
+    if (FLASH_Write(stream->pos, data, len) != 0)
+    {
+        return -1;
+    }
+    stream->pos += len;
+
+    return 0;
+}
+
+/**
+ * @brief  Tells what updating a chunk of a sector needs.
+ * @param  In: dst_addr    Destination address in the FLASH memory.
+ * @param  In: src         New contents.
+ * @param  In: len         Number of bytes.
+ * @retval FLASH_UPDATE_UNCHANGED: The FLASH already holds the new contents.
+ *         FLASH_UPDATE_PROGRAM:   The new contents only clear bits, so they can be programmed in place.
+ *         FLASH_UPDATE_ERASE:     Some bit goes from 0 to 1, so the sector must be erased.
+ */
+static int FLASH_Update_Kind(uint32_t dst_addr, const uint8_t *src, uint32_t len)
+{
+    const uint8_t *dst = (const uint8_t *) dst_addr;
+    int kind = FLASH_UPDATE_UNCHANGED;
+
+    for (uint32_t i = 0; i < len; i++)
+    {
+        if (dst[i] != src[i])
+        {
+            if ((dst[i] & src[i]) != src[i])
+            {
+                return FLASH_UPDATE_ERASE;
+            }
+            kind = FLASH_UPDATE_PROGRAM;
+        }
+    }
+
+    return kind;
+}
+
+/**
+ * @brief  Program a chunk of the FLASH memory without erasing.
+ * @note   The new contents must only clear bits (see FLASH_Update_Kind). Only the words that change are programmed.
+ * @param  In: dst_addr    Destination address in the FLASH memory (no alignment constraint).
+ * @param  In: src         New contents.
+ * @param  In: len         Number of bytes.
+ * @retval  0:  Success.
+ *         -1:  Failure.
+ */
+static int FLASH_Program_In_Place(uint32_t dst_addr, const uint8_t *src, uint32_t len)
+{
+    uint32_t end = dst_addr + len;
+    uint32_t addr;
+    uint32_t word;
+    uint32_t i;
+
+    for (addr = ROUND_DOWN(dst_addr, 4); addr < end; addr += 4)
+    {
+        word = *(uint32_t *) addr;
+        for (i = 0; i < 4; i++)
+        {
+            if (addr + i >= dst_addr && addr + i < end)
+            {
+                ((uint8_t *) &word)[i] = src[addr + i - dst_addr];
+            }
+        }
+
+        if (word != *(uint32_t *) addr)
+        {
+            if (FLASH_Write(addr, &word, 4) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
 /**
  * @brief  Gets the sector number of a given address.
  * @param  In: address
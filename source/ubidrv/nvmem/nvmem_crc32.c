@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2022 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1)
+
+#include <stm32cubef2_extension/ubidrv/nvmem.h>
+
+/* Half-byte table of the reflected polynomial 0xEDB88320, small enough to keep in flash next to the code */
+static const uint32_t _g_nvmem_crc32_table[16] =
+{
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+uint32_t nvmem_crc32(uint32_t crc, const void * data, size_t len)
+{
+    const uint8_t * p = (const uint8_t *) data;
+
+    crc = ~crc;
+    while (len > 0)
+    {
+        crc ^= *p;
+        crc = (crc >> 4) ^ _g_nvmem_crc32_table[crc & 0x0F];
+        crc = (crc >> 4) ^ _g_nvmem_crc32_table[crc & 0x0F];
+        p++;
+        len--;
+    }
+
+    return ~crc;
+}
+
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) */
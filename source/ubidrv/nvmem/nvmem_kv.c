@@ -0,0 +1,1055 @@
+/*
+ * Copyright (c) 2022 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+
+#if (UBINOS__UBIDRV__INCLUDE_NVMEM == 1)
+
+#include <stm32cubef2_extension/ubidrv/nvmem.h>
+#include <stm32cubef2_extension/ubidrv/nvmem_kv.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Layout
+ *
+ * A sector starts with two words: NVMEM_KV_SECTOR_MAGIC and its generation (1, 2, ... in the order the sectors
+ * were started). Records follow back to back, each word aligned:
+ *
+ *   word 0     NVMEM_KV_REC_TAG | size of the record in words
+ *   word 1     sequence number
+ *   word 2     key length | value length << 16
+ *   word 3     type (NVMEM_KV_REC_SET, NVMEM_KV_REC_DELETE or NVMEM_KV_REC_GC_DONE)
+ *   word 4     CRC32 of words 1 ~ 3, the key and the value
+ *   key, value and 0xFF padding up to a word
+ *
+ * Word 0 is programmed before the rest, so a record torn by a power loss still tells where the next one starts
+ * and is only dropped by its CRC. An erased word 0 ends the log of a sector; any other value without the tag
+ * makes the rest of the sector unusable.
+ *
+ * Garbage collection starts the erased sector, copies the live records of the oldest sector into it as they are
+ * (same sequence numbers), appends a NVMEM_KV_REC_GC_DONE record holding the generation of the oldest sector,
+ * and erases the oldest sector. Other writes never take the last erased sector, so finding none on open means
+ * a garbage collection was cut: the oldest sector is erased if the newest one has its GC_DONE record, and
+ * the newest one is erased otherwise.
+ *
+ * SET records leave NVMEM_KV_HEADROOM free at the end of every sector, and DELETE records the room of
+ * a GC_DONE record. The live records of a sector then always fit in the erased sector together with
+ * the GC_DONE record, and a delete, which is what frees space, can still be written when sets no longer fit.
+ */
+
+#define NVMEM_KV_SECTOR_MAGIC       0x564B564E
+#define NVMEM_KV_SECTOR_HDR_SIZE    8
+
+#define NVMEM_KV_REC_TAG            0xC3A50000
+#define NVMEM_KV_REC_TAG_MASK       0xFFFF0000
+#define NVMEM_KV_REC_SIZE_MASK      0x0000FFFF
+#define NVMEM_KV_REC_HDR_SIZE       20
+#define NVMEM_KV_REC_SET            1
+#define NVMEM_KV_REC_DELETE         2
+#define NVMEM_KV_REC_GC_DONE        3
+#define NVMEM_KV_VALUE_MAX          0xFFFF
+
+#define NVMEM_KV_GC_DONE_SIZE       NVMEM_KV_ALIGN4(NVMEM_KV_REC_HDR_SIZE + 4)
+#define NVMEM_KV_DELETE_SIZE_MAX    NVMEM_KV_ALIGN4(NVMEM_KV_REC_HDR_SIZE + NVMEM_KV_KEY_MAX)
+#define NVMEM_KV_HEADROOM           (NVMEM_KV_GC_DONE_SIZE + NVMEM_KV_DELETE_SIZE_MAX)
+
+#define NVMEM_KV_ERASED             0xFFFFFFFF
+#define NVMEM_KV_ADDR_NONE          0xFFFFFFFF
+#define NVMEM_KV_CHUNK_SIZE         64
+
+#define NVMEM_KV_ALIGN4(a)          (((a) + 3) & ~3)
+#define NVMEM_KV_MIN(a,b)           (((a) < (b)) ? (a) : (b))
+#define NVMEM_KV_MAX(a,b)           (((a) > (b)) ? (a) : (b))
+
+typedef struct _nvmem_kv_rec_hdr_t
+{
+    uint32_t tag;
+    uint32_t seq;
+    uint32_t lens;
+    uint32_t type;
+    uint32_t crc;
+} nvmem_kv_rec_hdr_t;
+
+typedef struct _nvmem_kv_piece_t
+{
+    const uint8_t * data;
+    uint32_t len;
+} nvmem_kv_piece_t;
+
+static uint32_t _nvmem_kv_hash(const char * key, uint32_t klen);
+static uint32_t _nvmem_kv_sector_end(nvmem_kv_t * kv, uint32_t sector);
+static int _nvmem_kv_rec_size(nvmem_kv_t * kv, uint32_t addr, uint32_t end, nvmem_kv_rec_hdr_t * hdr);
+static int _nvmem_kv_rec_check(nvmem_kv_t * kv, uint32_t addr, int size, nvmem_kv_rec_hdr_t * hdr);
+static int _nvmem_kv_index_find(nvmem_kv_t * kv, const char * key, uint32_t klen, uint32_t hash);
+static ubi_err_t _nvmem_kv_index_put(nvmem_kv_t * kv, const char * key, uint32_t klen, uint32_t hash, uint32_t addr);
+static void _nvmem_kv_index_remove(nvmem_kv_t * kv, int slot);
+static ubi_err_t _nvmem_kv_program(nvmem_kv_t * kv, uint32_t addr, const nvmem_kv_piece_t * pieces, uint32_t count);
+static ubi_err_t _nvmem_kv_copy(nvmem_kv_t * kv, uint32_t dst, uint32_t src, uint32_t size);
+static ubi_err_t _nvmem_kv_start_sector(nvmem_kv_t * kv, uint32_t sector);
+static uint32_t _nvmem_kv_headroom(uint32_t type);
+static ubi_err_t _nvmem_kv_reserve(nvmem_kv_t * kv, uint32_t size, uint32_t headroom);
+static ubi_err_t _nvmem_kv_append(nvmem_kv_t * kv, uint32_t type, const char * key, uint32_t klen, const void * value, uint32_t vlen, uint32_t * addr);
+static ubi_err_t _nvmem_kv_live_slot(nvmem_kv_t * kv, uint32_t addr, int size, nvmem_kv_rec_hdr_t * hdr, int * slot);
+static ubi_err_t _nvmem_kv_live_size(nvmem_kv_t * kv, uint32_t sector, uint32_t * live);
+static ubi_err_t _nvmem_kv_reclaimable(nvmem_kv_t * kv, uint32_t * room);
+static ubi_err_t _nvmem_kv_gc(nvmem_kv_t * kv);
+static int _nvmem_kv_has_gc_done(nvmem_kv_t * kv, uint32_t sector, uint32_t gen);
+static int _nvmem_kv_is_erased(nvmem_kv_t * kv, uint32_t addr, uint32_t size);
+static ubi_err_t _nvmem_kv_scan(nvmem_kv_t * kv, uint32_t sector, uint32_t * end_addr);
+
+/* FNV-1a */
+static uint32_t _nvmem_kv_hash(const char * key, uint32_t klen)
+{
+    uint32_t hash = 0x811C9DC5;
+    uint32_t i;
+
+    for (i = 0; i < klen; i++)
+    {
+        hash ^= (uint8_t) key[i];
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+static uint32_t _nvmem_kv_sector_end(nvmem_kv_t * kv, uint32_t sector)
+{
+    return kv->sector_addr[sector] + kv->sector_size;
+}
+
+/* Size of the record at addr in bytes, 0 at the end of the log, or -1 when the rest of the sector is unusable */
+static int _nvmem_kv_rec_size(nvmem_kv_t * kv, uint32_t addr, uint32_t end, nvmem_kv_rec_hdr_t * hdr)
+{
+    uint32_t size;
+
+    if (addr + 4 > end)
+    {
+        return 0;
+    }
+
+    if (kv->ops->read(kv->ops->ctx, addr, &hdr->tag, 4) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+
+    if (hdr->tag == NVMEM_KV_ERASED)
+    {
+        return 0;
+    }
+
+    size = (hdr->tag & NVMEM_KV_REC_SIZE_MASK) * 4;
+    if ((hdr->tag & NVMEM_KV_REC_TAG_MASK) != NVMEM_KV_REC_TAG || size < NVMEM_KV_REC_HDR_SIZE || addr + size > end)
+    {
+        return -1;
+    }
+
+    if (kv->ops->read(kv->ops->ctx, addr + 4, &hdr->seq, NVMEM_KV_REC_HDR_SIZE - 4) != UBI_ERR_OK)
+    {
+        return -1;
+    }
+
+    return (int) size;
+}
+
+/* Whether the record at addr is complete */
+static int _nvmem_kv_rec_check(nvmem_kv_t * kv, uint32_t addr, int size, nvmem_kv_rec_hdr_t * hdr)
+{
+    uint8_t chunk[NVMEM_KV_CHUNK_SIZE];
+    uint32_t klen = hdr->lens & 0xFFFF;
+    uint32_t vlen = hdr->lens >> 16;
+    uint32_t rest;
+    uint32_t n;
+    uint32_t crc;
+
+    if (NVMEM_KV_ALIGN4(NVMEM_KV_REC_HDR_SIZE + klen + vlen) != (uint32_t) size || klen > NVMEM_KV_KEY_MAX)
+    {
+        return 0;
+    }
+
+    crc = nvmem_crc32(0, &hdr->seq, 12);
+    addr += NVMEM_KV_REC_HDR_SIZE;
+    for (rest = klen + vlen; rest > 0; rest -= n)
+    {
+        n = NVMEM_KV_MIN(rest, NVMEM_KV_CHUNK_SIZE);
+        if (kv->ops->read(kv->ops->ctx, addr, chunk, n) != UBI_ERR_OK)
+        {
+            return 0;
+        }
+        crc = nvmem_crc32(crc, chunk, n);
+        addr += n;
+    }
+
+    return crc == hdr->crc;
+}
+
+/* Slot of key in the index, or -1 */
+static int _nvmem_kv_index_find(nvmem_kv_t * kv, const char * key, uint32_t klen, uint32_t hash)
+{
+    char rec_key[NVMEM_KV_KEY_MAX];
+    uint32_t lens;
+    uint32_t mask = kv->index_size - 1;
+    uint32_t i;
+
+    for (i = hash & mask; kv->index[i].addr != NVMEM_KV_ADDR_NONE; i = (i + 1) & mask)
+    {
+        if (kv->index[i].hash != hash)
+        {
+            continue;
+        }
+        if (kv->ops->read(kv->ops->ctx, kv->index[i].addr + 8, &lens, 4) != UBI_ERR_OK || (lens & 0xFFFF) != klen)
+        {
+            continue;
+        }
+        if (kv->ops->read(kv->ops->ctx, kv->index[i].addr + NVMEM_KV_REC_HDR_SIZE, rec_key, klen) == UBI_ERR_OK &&
+                memcmp(rec_key, key, klen) == 0)
+        {
+            return (int) i;
+        }
+    }
+
+    return -1;
+}
+
+static ubi_err_t _nvmem_kv_index_put(nvmem_kv_t * kv, const char * key, uint32_t klen, uint32_t hash, uint32_t addr)
+{
+    uint32_t mask = kv->index_size - 1;
+    uint32_t i;
+    int slot;
+
+    slot = _nvmem_kv_index_find(kv, key, klen, hash);
+    if (slot >= 0)
+    {
+        kv->index[slot].addr = addr;
+        return UBI_ERR_OK;
+    }
+
+    /* Keep a free slot to end every probe */
+    if (kv->count + 1 >= kv->index_size)
+    {
+        return UBI_ERR_NO_MEM;
+    }
+
+    for (i = hash & mask; kv->index[i].addr != NVMEM_KV_ADDR_NONE; i = (i + 1) & mask)
+    {
+    }
+    kv->index[i].hash = hash;
+    kv->index[i].addr = addr;
+    kv->count++;
+
+    return UBI_ERR_OK;
+}
+
+/* Linear probing deletion: move later entries of the probe back into the hole instead of leaving tombstones */
+static void _nvmem_kv_index_remove(nvmem_kv_t * kv, int slot)
+{
+    uint32_t mask = kv->index_size - 1;
+    uint32_t i = (uint32_t) slot;
+    uint32_t j = i;
+    uint32_t home;
+
+    for (;;)
+    {
+        kv->index[i].addr = NVMEM_KV_ADDR_NONE;
+        for (;;)
+        {
+            j = (j + 1) & mask;
+            if (kv->index[j].addr == NVMEM_KV_ADDR_NONE)
+            {
+                kv->count--;
+                return;
+            }
+            home = kv->index[j].hash & mask;
+            /* The entry stays when its home is cyclically in (i, j] */
+            if ((i <= j) ? (i < home && home <= j) : (i < home || home <= j))
+            {
+                continue;
+            }
+            kv->index[i] = kv->index[j];
+            i = j;
+            break;
+        }
+    }
+}
+
+/* Program the concatenation of pieces at addr, padded with 0xFF up to a word */
+static ubi_err_t _nvmem_kv_program(nvmem_kv_t * kv, uint32_t addr, const nvmem_kv_piece_t * pieces, uint32_t count)
+{
+    uint32_t chunk[NVMEM_KV_CHUNK_SIZE / 4];
+    uint32_t fill = 0;
+    uint32_t off;
+    uint32_t n;
+    uint32_t i;
+    ubi_err_t ubi_err = UBI_ERR_OK;
+
+    for (i = 0; i < count && ubi_err == UBI_ERR_OK; i++)
+    {
+        for (off = 0; off < pieces[i].len; off += n)
+        {
+            n = NVMEM_KV_MIN(pieces[i].len - off, NVMEM_KV_CHUNK_SIZE - fill);
+            memcpy((uint8_t *) chunk + fill, pieces[i].data + off, n);
+            fill += n;
+            if (fill == NVMEM_KV_CHUNK_SIZE)
+            {
+                ubi_err = kv->ops->program(kv->ops->ctx, addr, chunk, fill);
+                if (ubi_err != UBI_ERR_OK)
+                {
+                    break;
+                }
+                addr += fill;
+                fill = 0;
+            }
+        }
+    }
+
+    if (ubi_err == UBI_ERR_OK && fill > 0)
+    {
+        memset((uint8_t *) chunk + fill, 0xFF, NVMEM_KV_ALIGN4(fill) - fill);
+        ubi_err = kv->ops->program(kv->ops->ctx, addr, chunk, NVMEM_KV_ALIGN4(fill));
+    }
+
+    return ubi_err;
+}
+
+/* Copy a record, word 0 first */
+static ubi_err_t _nvmem_kv_copy(nvmem_kv_t * kv, uint32_t dst, uint32_t src, uint32_t size)
+{
+    uint32_t chunk[NVMEM_KV_CHUNK_SIZE / 4];
+    uint32_t off;
+    uint32_t n;
+    ubi_err_t ubi_err;
+
+    ubi_err = kv->ops->read(kv->ops->ctx, src, chunk, 4);
+    if (ubi_err == UBI_ERR_OK)
+    {
+        ubi_err = kv->ops->program(kv->ops->ctx, dst, chunk, 4);
+    }
+
+    for (off = 4; off < size && ubi_err == UBI_ERR_OK; off += n)
+    {
+        n = NVMEM_KV_MIN(size - off, NVMEM_KV_CHUNK_SIZE);
+        ubi_err = kv->ops->read(kv->ops->ctx, src + off, chunk, n);
+        if (ubi_err == UBI_ERR_OK)
+        {
+            ubi_err = kv->ops->program(kv->ops->ctx, dst + off, chunk, n);
+        }
+    }
+
+    return ubi_err;
+}
+
+/* Make an erased sector the newest one and continue the log there */
+static ubi_err_t _nvmem_kv_start_sector(nvmem_kv_t * kv, uint32_t sector)
+{
+    uint32_t hdr[2];
+    uint32_t gen = 0;
+    uint32_t i;
+    ubi_err_t ubi_err;
+
+    for (i = 0; i < kv->sector_num; i++)
+    {
+        gen = NVMEM_KV_MAX(gen, kv->sector_gen[i]);
+    }
+
+    hdr[0] = NVMEM_KV_SECTOR_MAGIC;
+    hdr[1] = gen + 1;
+    ubi_err = kv->ops->program(kv->ops->ctx, kv->sector_addr[sector], hdr, NVMEM_KV_SECTOR_HDR_SIZE);
+    if (ubi_err != UBI_ERR_OK)
+    {
+        return ubi_err;
+    }
+
+    kv->sector_gen[sector] = gen + 1;
+    kv->active = sector;
+    kv->write_addr = kv->sector_addr[sector] + NVMEM_KV_SECTOR_HDR_SIZE;
+
+    return UBI_ERR_OK;
+}
+
+/* Bytes a record of type must leave free after it in its sector */
+static uint32_t _nvmem_kv_headroom(uint32_t type)
+{
+    switch (type)
+    {
+    case NVMEM_KV_REC_SET:
+        return NVMEM_KV_HEADROOM;
+    case NVMEM_KV_REC_DELETE:
+        return NVMEM_KV_GC_DONE_SIZE;
+    default:
+        return 0;
+    }
+}
+
+/* Make room for a record of size bytes at write_addr, with headroom bytes left free after it */
+static ubi_err_t _nvmem_kv_reserve(nvmem_kv_t * kv, uint32_t size, uint32_t headroom)
+{
+    ubi_err_t ubi_err;
+    uint32_t free_num;
+    uint32_t free_sector = 0;
+    uint32_t room;
+    uint32_t tries;
+    uint32_t i;
+
+    if (size + headroom > kv->sector_size - NVMEM_KV_SECTOR_HDR_SIZE)
+    {
+        return UBI_ERR_PARAM;
+    }
+
+    for (tries = 0; tries <= kv->sector_num; tries++)
+    {
+        if (kv->write_addr + size + headroom <= _nvmem_kv_sector_end(kv, kv->active))
+        {
+            return UBI_ERR_OK;
+        }
+
+        free_num = 0;
+        for (i = 0; i < kv->sector_num; i++)
+        {
+            if (kv->sector_gen[i] == 0)
+            {
+                free_sector = i;
+                free_num++;
+            }
+        }
+
+        if (free_num >= 2)
+        {
+            ubi_err = _nvmem_kv_start_sector(kv, free_sector);
+        }
+        else
+        {
+            /* Collecting every sector could not make the room either: fail without wearing the flash */
+            ubi_err = _nvmem_kv_reclaimable(kv, &room);
+            if (ubi_err == UBI_ERR_OK && room < size + headroom)
+            {
+                ubi_err = UBI_ERR_BUF_FULL;
+            }
+            if (ubi_err == UBI_ERR_OK)
+            {
+                ubi_err = _nvmem_kv_gc(kv);
+            }
+        }
+        if (ubi_err != UBI_ERR_OK)
+        {
+            return ubi_err;
+        }
+    }
+
+    return UBI_ERR_BUF_FULL;
+}
+
+static ubi_err_t _nvmem_kv_append(nvmem_kv_t * kv, uint32_t type, const char * key, uint32_t klen, const void * value, uint32_t vlen, uint32_t * addr)
+{
+    nvmem_kv_rec_hdr_t hdr;
+    nvmem_kv_piece_t pieces[3];
+    uint32_t size = NVMEM_KV_ALIGN4(NVMEM_KV_REC_HDR_SIZE + klen + vlen);
+    ubi_err_t ubi_err;
+
+    ubi_err = _nvmem_kv_reserve(kv, size, _nvmem_kv_headroom(type));
+    if (ubi_err != UBI_ERR_OK)
+    {
+        return ubi_err;
+    }
+
+    hdr.tag = NVMEM_KV_REC_TAG | (size / 4);
+    hdr.seq = ++kv->seq;
+    hdr.lens = klen | (vlen << 16);
+    hdr.type = type;
+    hdr.crc = nvmem_crc32(0, &hdr.seq, 12);
+    hdr.crc = nvmem_crc32(hdr.crc, key, klen);
+    hdr.crc = nvmem_crc32(hdr.crc, value, vlen);
+
+    *addr = kv->write_addr;
+
+    ubi_err = kv->ops->program(kv->ops->ctx, *addr, &hdr.tag, 4);
+    if (ubi_err != UBI_ERR_OK)
+    {
+        /* The word may be partly programmed; nothing more goes into this sector */
+        kv->write_addr = _nvmem_kv_sector_end(kv, kv->active);
+        return ubi_err;
+    }
+    kv->write_addr += size;
+
+    pieces[0].data = (const uint8_t *) &hdr.seq;
+    pieces[0].len = NVMEM_KV_REC_HDR_SIZE - 4;
+    pieces[1].data = (const uint8_t *) key;
+    pieces[1].len = klen;
+    pieces[2].data = (const uint8_t *) value;
+    pieces[2].len = vlen;
+
+    return _nvmem_kv_program(kv, *addr + 4, pieces, 3);
+}
+
+/* Index slot of the record at addr when it is the live record of its key, or -1 */
+static ubi_err_t _nvmem_kv_live_slot(nvmem_kv_t * kv, uint32_t addr, int size, nvmem_kv_rec_hdr_t * hdr, int * slot)
+{
+    char key[NVMEM_KV_KEY_MAX];
+    uint32_t klen;
+    ubi_err_t ubi_err;
+
+    *slot = -1;
+
+    if (hdr->type != NVMEM_KV_REC_SET || !_nvmem_kv_rec_check(kv, addr, size, hdr))
+    {
+        return UBI_ERR_OK;
+    }
+
+    klen = hdr->lens & 0xFFFF;
+    ubi_err = kv->ops->read(kv->ops->ctx, addr + NVMEM_KV_REC_HDR_SIZE, key, klen);
+    if (ubi_err != UBI_ERR_OK)
+    {
+        return ubi_err;
+    }
+    *slot = _nvmem_kv_index_find(kv, key, klen, _nvmem_kv_hash(key, klen));
+    if (*slot >= 0 && kv->index[*slot].addr != addr)
+    {
+        *slot = -1;
+    }
+
+    return UBI_ERR_OK;
+}
+
+/* Bytes of the live records of a sector */
+static ubi_err_t _nvmem_kv_live_size(nvmem_kv_t * kv, uint32_t sector, uint32_t * live)
+{
+    nvmem_kv_rec_hdr_t hdr;
+    uint32_t end = _nvmem_kv_sector_end(kv, sector);
+    uint32_t addr;
+    int size;
+    int slot;
+    ubi_err_t ubi_err;
+
+    *live = 0;
+    for (addr = kv->sector_addr[sector] + NVMEM_KV_SECTOR_HDR_SIZE; ; addr += size)
+    {
+        size = _nvmem_kv_rec_size(kv, addr, end, &hdr);
+        if (size <= 0)
+        {
+            break;
+        }
+        ubi_err = _nvmem_kv_live_slot(kv, addr, size, &hdr, &slot);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            return ubi_err;
+        }
+        if (slot >= 0)
+        {
+            *live += size;
+        }
+    }
+
+    return UBI_ERR_OK;
+}
+
+/* Largest free space a garbage collection can leave; a collection moves the live records of one sector
+ * into the erased one, behind which come the GC_DONE record and then the new records */
+static ubi_err_t _nvmem_kv_reclaimable(nvmem_kv_t * kv, uint32_t * room)
+{
+    uint32_t live;
+    uint32_t i;
+    ubi_err_t ubi_err;
+
+    *room = 0;
+    for (i = 0; i < kv->sector_num; i++)
+    {
+        if (kv->sector_gen[i] == 0)
+        {
+            continue;
+        }
+        ubi_err = _nvmem_kv_live_size(kv, i, &live);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            return ubi_err;
+        }
+        if (NVMEM_KV_SECTOR_HDR_SIZE + live + NVMEM_KV_GC_DONE_SIZE <= kv->sector_size)
+        {
+            *room = NVMEM_KV_MAX(*room, kv->sector_size - NVMEM_KV_SECTOR_HDR_SIZE - live - NVMEM_KV_GC_DONE_SIZE);
+        }
+    }
+
+    return UBI_ERR_OK;
+}
+
+static ubi_err_t _nvmem_kv_gc(nvmem_kv_t * kv)
+{
+    nvmem_kv_rec_hdr_t hdr;
+    uint32_t oldest = NVMEM_KV_SECTOR_NUM_MAX;
+    uint32_t target = NVMEM_KV_SECTOR_NUM_MAX;
+    uint32_t old_gen;
+    uint32_t live;
+    uint32_t addr;
+    uint32_t end;
+    uint32_t dummy;
+    uint32_t i;
+    int size;
+    int slot;
+    ubi_err_t ubi_err;
+
+    for (i = 0; i < kv->sector_num; i++)
+    {
+        if (kv->sector_gen[i] == 0)
+        {
+            target = i;
+        }
+        else if (oldest == NVMEM_KV_SECTOR_NUM_MAX || kv->sector_gen[i] < kv->sector_gen[oldest])
+        {
+            oldest = i;
+        }
+    }
+    if (target == NVMEM_KV_SECTOR_NUM_MAX || oldest == NVMEM_KV_SECTOR_NUM_MAX)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+    old_gen = kv->sector_gen[oldest];
+
+    /* Do not start what cannot finish: the live records and the GC_DONE record must fit in the erased sector */
+    ubi_err = _nvmem_kv_live_size(kv, oldest, &live);
+    if (ubi_err != UBI_ERR_OK)
+    {
+        return ubi_err;
+    }
+    if (NVMEM_KV_SECTOR_HDR_SIZE + live + NVMEM_KV_GC_DONE_SIZE > kv->sector_size)
+    {
+        return UBI_ERR_BUF_FULL;
+    }
+
+    ubi_err = _nvmem_kv_start_sector(kv, target);
+    if (ubi_err != UBI_ERR_OK)
+    {
+        return ubi_err;
+    }
+
+    end = _nvmem_kv_sector_end(kv, oldest);
+    for (addr = kv->sector_addr[oldest] + NVMEM_KV_SECTOR_HDR_SIZE; ; addr += size)
+    {
+        size = _nvmem_kv_rec_size(kv, addr, end, &hdr);
+        if (size <= 0)
+        {
+            break;
+        }
+        ubi_err = _nvmem_kv_live_slot(kv, addr, size, &hdr, &slot);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            return ubi_err;
+        }
+        if (slot < 0)
+        {
+            continue;
+        }
+
+        ubi_err = _nvmem_kv_copy(kv, kv->write_addr, addr, size);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            return ubi_err;
+        }
+        kv->index[slot].addr = kv->write_addr;
+        kv->write_addr += size;
+    }
+
+    ubi_err = _nvmem_kv_append(kv, NVMEM_KV_REC_GC_DONE, NULL, 0, &old_gen, sizeof(old_gen), &dummy);
+    if (ubi_err != UBI_ERR_OK)
+    {
+        return ubi_err;
+    }
+
+    ubi_err = kv->ops->erase(kv->ops->ctx, kv->sector_addr[oldest], kv->sector_size);
+    if (ubi_err != UBI_ERR_OK)
+    {
+        return ubi_err;
+    }
+    kv->sector_gen[oldest] = 0;
+    kv->gc_count++;
+
+    return UBI_ERR_OK;
+}
+
+/* Whether sector holds the GC_DONE record of the sector of generation gen */
+static int _nvmem_kv_has_gc_done(nvmem_kv_t * kv, uint32_t sector, uint32_t gen)
+{
+    nvmem_kv_rec_hdr_t hdr;
+    uint32_t end = _nvmem_kv_sector_end(kv, sector);
+    uint32_t addr;
+    uint32_t value;
+    int size;
+
+    for (addr = kv->sector_addr[sector] + NVMEM_KV_SECTOR_HDR_SIZE; ; addr += size)
+    {
+        size = _nvmem_kv_rec_size(kv, addr, end, &hdr);
+        if (size <= 0)
+        {
+            return 0;
+        }
+        if (hdr.type == NVMEM_KV_REC_GC_DONE && _nvmem_kv_rec_check(kv, addr, size, &hdr) &&
+                kv->ops->read(kv->ops->ctx, addr + NVMEM_KV_REC_HDR_SIZE, &value, 4) == UBI_ERR_OK && value == gen)
+        {
+            return 1;
+        }
+    }
+}
+
+static int _nvmem_kv_is_erased(nvmem_kv_t * kv, uint32_t addr, uint32_t size)
+{
+    uint32_t chunk[NVMEM_KV_CHUNK_SIZE / 4];
+    uint32_t off;
+    uint32_t i;
+
+    for (off = 0; off < size; off += NVMEM_KV_CHUNK_SIZE)
+    {
+        if (kv->ops->read(kv->ops->ctx, addr + off, chunk, NVMEM_KV_CHUNK_SIZE) != UBI_ERR_OK)
+        {
+            return 0;
+        }
+        for (i = 0; i < NVMEM_KV_CHUNK_SIZE / 4; i++)
+        {
+            if (chunk[i] != NVMEM_KV_ERASED)
+            {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+/* Apply the records of a sector to the index */
+static ubi_err_t _nvmem_kv_scan(nvmem_kv_t * kv, uint32_t sector, uint32_t * end_addr)
+{
+    nvmem_kv_rec_hdr_t hdr;
+    char key[NVMEM_KV_KEY_MAX];
+    uint32_t end = _nvmem_kv_sector_end(kv, sector);
+    uint32_t klen;
+    uint32_t hash;
+    uint32_t addr;
+    int size;
+    int slot;
+    ubi_err_t ubi_err;
+
+    for (addr = kv->sector_addr[sector] + NVMEM_KV_SECTOR_HDR_SIZE; ; addr += size)
+    {
+        size = _nvmem_kv_rec_size(kv, addr, end, &hdr);
+        if (size == 0)
+        {
+            break;
+        }
+        if (size < 0)
+        {
+            addr = end;
+            break;
+        }
+        if (!_nvmem_kv_rec_check(kv, addr, size, &hdr))
+        {
+            continue;
+        }
+
+        kv->seq = NVMEM_KV_MAX(kv->seq, hdr.seq);
+
+        klen = hdr.lens & 0xFFFF;
+        if (hdr.type != NVMEM_KV_REC_SET && hdr.type != NVMEM_KV_REC_DELETE)
+        {
+            continue;
+        }
+        ubi_err = kv->ops->read(kv->ops->ctx, addr + NVMEM_KV_REC_HDR_SIZE, key, klen);
+        if (ubi_err != UBI_ERR_OK)
+        {
+            return ubi_err;
+        }
+        hash = _nvmem_kv_hash(key, klen);
+
+        if (hdr.type == NVMEM_KV_REC_SET)
+        {
+            ubi_err = _nvmem_kv_index_put(kv, key, klen, hash, addr);
+            if (ubi_err != UBI_ERR_OK)
+            {
+                return ubi_err;
+            }
+        }
+        else
+        {
+            slot = _nvmem_kv_index_find(kv, key, klen, hash);
+            if (slot >= 0)
+            {
+                _nvmem_kv_index_remove(kv, slot);
+            }
+        }
+    }
+
+    *end_addr = addr;
+
+    return UBI_ERR_OK;
+}
+
+ubi_err_t nvmem_kv_open(nvmem_kv_t * kv)
+{
+    ubi_err_t ubi_err;
+    uint32_t hdr[2];
+    uint32_t order[NVMEM_KV_SECTOR_NUM_MAX];
+    uint32_t order_num;
+    uint32_t oldest;
+    uint32_t newest;
+    uint32_t end_addr;
+    uint32_t i;
+    uint32_t j;
+
+    do
+    {
+        if (kv == NULL || kv->ops == NULL || kv->sector_num < 2 || kv->sector_num > NVMEM_KV_SECTOR_NUM_MAX ||
+                kv->sector_size < NVMEM_KV_SECTOR_HDR_SIZE + NVMEM_KV_REC_HDR_SIZE + NVMEM_KV_KEY_MAX + NVMEM_KV_HEADROOM ||
+                (kv->sector_size % NVMEM_KV_CHUNK_SIZE) != 0 ||
+                kv->index_size < 2 || (kv->index_size & (kv->index_size - 1)) != 0)
+        {
+            ubi_err = UBI_ERR_PARAM;
+            break;
+        }
+
+        kv->index = malloc(kv->index_size * sizeof(nvmem_kv_index_entry_t));
+        if (kv->index == NULL)
+        {
+            ubi_err = UBI_ERR_NO_MEM;
+            break;
+        }
+        for (i = 0; i < kv->index_size; i++)
+        {
+            kv->index[i].addr = NVMEM_KV_ADDR_NONE;
+        }
+        kv->count = 0;
+        kv->seq = 0;
+        kv->gc_count = 0;
+
+        /* Sector headers; anything but a valid header over a sector, or an erased one, is erased */
+        ubi_err = UBI_ERR_OK;
+        for (i = 0; i < kv->sector_num && ubi_err == UBI_ERR_OK; i++)
+        {
+            kv->sector_gen[i] = 0;
+            ubi_err = kv->ops->read(kv->ops->ctx, kv->sector_addr[i], hdr, sizeof(hdr));
+            if (ubi_err != UBI_ERR_OK)
+            {
+                break;
+            }
+            if (hdr[0] == NVMEM_KV_SECTOR_MAGIC && hdr[1] != 0 && hdr[1] != NVMEM_KV_ERASED)
+            {
+                kv->sector_gen[i] = hdr[1];
+            }
+            else if (!_nvmem_kv_is_erased(kv, kv->sector_addr[i], kv->sector_size))
+            {
+                ubi_err = kv->ops->erase(kv->ops->ctx, kv->sector_addr[i], kv->sector_size);
+            }
+        }
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+
+        /* Sectors in log order */
+        order_num = 0;
+        for (i = 0; i < kv->sector_num; i++)
+        {
+            if (kv->sector_gen[i] == 0)
+            {
+                continue;
+            }
+            for (j = order_num; j > 0 && kv->sector_gen[order[j - 1]] > kv->sector_gen[i]; j--)
+            {
+                order[j] = order[j - 1];
+            }
+            order[j] = i;
+            order_num++;
+        }
+
+        /* A cut garbage collection */
+        if (order_num == kv->sector_num)
+        {
+            oldest = order[0];
+            newest = order[order_num - 1];
+            if (_nvmem_kv_has_gc_done(kv, newest, kv->sector_gen[oldest]))
+            {
+                ubi_err = kv->ops->erase(kv->ops->ctx, kv->sector_addr[oldest], kv->sector_size);
+                kv->sector_gen[oldest] = 0;
+                memmove(&order[0], &order[1], (order_num - 1) * sizeof(order[0]));
+            }
+            else
+            {
+                ubi_err = kv->ops->erase(kv->ops->ctx, kv->sector_addr[newest], kv->sector_size);
+                kv->sector_gen[newest] = 0;
+            }
+            order_num--;
+            if (ubi_err != UBI_ERR_OK)
+            {
+                break;
+            }
+        }
+
+        if (order_num == 0)
+        {
+            ubi_err = _nvmem_kv_start_sector(kv, 0);
+            break;
+        }
+
+        for (i = 0; i < order_num && ubi_err == UBI_ERR_OK; i++)
+        {
+            ubi_err = _nvmem_kv_scan(kv, order[i], &end_addr);
+        }
+        if (ubi_err != UBI_ERR_OK)
+        {
+            break;
+        }
+
+        kv->active = order[order_num - 1];
+        kv->write_addr = end_addr;
+
+        break;
+    } while (1);
+
+    if (ubi_err != UBI_ERR_OK && ubi_err != UBI_ERR_PARAM && kv->index != NULL)
+    {
+        free(kv->index);
+        kv->index = NULL;
+    }
+
+    return ubi_err;
+}
+
+ubi_err_t nvmem_kv_close(nvmem_kv_t * kv)
+{
+    if (kv == NULL || kv->index == NULL)
+    {
+        return UBI_ERR_INVALID_STATE;
+    }
+
+    free(kv->index);
+    kv->index = NULL;
+
+    return UBI_ERR_OK;
+}
+
+ubi_err_t nvmem_kv_get(nvmem_kv_t * kv, const char * key, void * buf, uint32_t size, uint32_t * len)
+{
+    uint32_t klen;
+    uint32_t lens;
+    uint32_t vlen;
+    uint32_t addr;
+    int slot;
+
+    if (kv == NULL || kv->index == NULL || key == NULL)
+    {
+        return UBI_ERR_PARAM;
+    }
+
+    klen = strlen(key);
+    if (klen == 0 || klen > NVMEM_KV_KEY_MAX)
+    {
+        return UBI_ERR_PARAM;
+    }
+
+    slot = _nvmem_kv_index_find(kv, key, klen, _nvmem_kv_hash(key, klen));
+    if (slot < 0)
+    {
+        return UBI_ERR_NOT_FOUND;
+    }
+
+    addr = kv->index[slot].addr;
+    if (kv->ops->read(kv->ops->ctx, addr + 8, &lens, 4) != UBI_ERR_OK)
+    {
+        return UBI_ERR_IO;
+    }
+    vlen = lens >> 16;
+    if (len != NULL)
+    {
+        *len = vlen;
+    }
+    if (vlen > size)
+    {
+        return UBI_ERR_BUF_FULL;
+    }
+
+    return kv->ops->read(kv->ops->ctx, addr + NVMEM_KV_REC_HDR_SIZE + klen, buf, vlen);
+}
+
+ubi_err_t nvmem_kv_set(nvmem_kv_t * kv, const char * key, const void * value, uint32_t len)
+{
+    ubi_err_t ubi_err;
+    uint32_t klen;
+    uint32_t hash;
+    uint32_t addr;
+
+    if (kv == NULL || kv->index == NULL || key == NULL || (value == NULL && len > 0) || len > NVMEM_KV_VALUE_MAX)
+    {
+        return UBI_ERR_PARAM;
+    }
+
+    klen = strlen(key);
+    if (klen == 0 || klen > NVMEM_KV_KEY_MAX)
+    {
+        return UBI_ERR_PARAM;
+    }
+
+    hash = _nvmem_kv_hash(key, klen);
+    if (_nvmem_kv_index_find(kv, key, klen, hash) < 0 && kv->count + 1 >= kv->index_size)
+    {
+        return UBI_ERR_NO_MEM;
+    }
+
+    ubi_err = _nvmem_kv_append(kv, NVMEM_KV_REC_SET, key, klen, value, len, &addr);
+    if (ubi_err != UBI_ERR_OK)
+    {
+        return ubi_err;
+    }
+
+    return _nvmem_kv_index_put(kv, key, klen, hash, addr);
+}
+
+ubi_err_t nvmem_kv_delete(nvmem_kv_t * kv, const char * key)
+{
+    ubi_err_t ubi_err;
+    uint32_t klen;
+    uint32_t hash;
+    uint32_t addr;
+    int slot;
+
+    if (kv == NULL || kv->index == NULL || key == NULL)
+    {
+        return UBI_ERR_PARAM;
+    }
+
+    klen = strlen(key);
+    if (klen == 0 || klen > NVMEM_KV_KEY_MAX)
+    {
+        return UBI_ERR_PARAM;
+    }
+
+    hash = _nvmem_kv_hash(key, klen);
+    if (_nvmem_kv_index_find(kv, key, klen, hash) < 0)
+    {
+        return UBI_ERR_NOT_FOUND;
+    }
+
+    ubi_err = _nvmem_kv_append(kv, NVMEM_KV_REC_DELETE, key, klen, NULL, 0, &addr);
+    if (ubi_err != UBI_ERR_OK)
+    {
+        return ubi_err;
+    }
+
+    /* Garbage collection moves entries but never adds or removes them, so find again only for the slot */
+    slot = _nvmem_kv_index_find(kv, key, klen, hash);
+    if (slot >= 0)
+    {
+        _nvmem_kv_index_remove(kv, slot);
+    }
+
+    return UBI_ERR_OK;
+}
+
+ubi_err_t nvmem_kv_gc(nvmem_kv_t * kv)
+{
+    if (kv == NULL || kv->index == NULL)
+    {
+        return UBI_ERR_PARAM;
+    }
+
+    return _nvmem_kv_gc(kv);
+}
+
+#endif /* (UBINOS__UBIDRV__INCLUDE_NVMEM == 1) */
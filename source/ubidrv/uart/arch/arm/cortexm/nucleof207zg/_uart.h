@@ -16,10 +16,40 @@ extern "C"
 #define UBIDEV_UART_IO_OPTION__TIMED   0x0001
 #define UBIDEV_UART_IO_OPTION__BLOCKED 0x0002
 
-#define UBIDRV_UART_FILE_NUM            2
-#define UBIDRV_UART_CHECK_INTERVAL_MS   1000
-#define UBIDRV_UART_READ_BUFFER_SIZE    (512)
-#define UBIDRV_UART_WRITE_BUFFER_SIZE   (1024 * 10)
+#define UBIDRV_UART_FILE_NUM            STM32CUBEF2__UBIDRV_UART_FILE_NUM
+#define UBIDRV_UART_FILE_NUM_MAX        6
+#define UBIDRV_UART_FILE_NAME_PREFIX    "/dev/tty"
+
+#if (UBIDRV_UART_FILE_NUM < 1) || (UBIDRV_UART_FILE_NUM > UBIDRV_UART_FILE_NUM_MAX)
+    #error "Unsupported STM32CUBEF2__UBIDRV_UART_FILE_NUM"
+#endif
+
+/* The dtty console (UBIDRV_UART_CONSOLE_FILE_NAME) runs on one more slot after /dev/ttyN */
+#if (STM32CUBEF2__DTTY_STM32_UART_ENABLE == 1)
+#define UBIDRV_UART_CONSOLE_FD          (UBIDRV_UART_FILE_NUM + 1)
+#define UBIDRV_UART_FILE_SLOT_NUM       (UBIDRV_UART_FILE_NUM + 1)
+#else
+#define UBIDRV_UART_FILE_SLOT_NUM       (UBIDRV_UART_FILE_NUM)
+#endif
+#define UBIDRV_UART_CHECK_INTERVAL_MS   STM32CUBEF2__UBIDRV_UART_CHECK_INTERVAL_MS
+#define UBIDRV_UART_READ_BUFFER_SIZE    STM32CUBEF2__UBIDRV_UART_READ_BUFFER_SIZE
+#define UBIDRV_UART_WRITE_BUFFER_SIZE   STM32CUBEF2__UBIDRV_UART_WRITE_BUFFER_SIZE
+
+#if ((UBIDRV_UART_READ_BUFFER_SIZE) & ((UBIDRV_UART_READ_BUFFER_SIZE) - 1)) != 0
+    #error "STM32CUBEF2__UBIDRV_UART_READ_BUFFER_SIZE must be a power of two"
+#endif
+#if ((UBIDRV_UART_WRITE_BUFFER_SIZE) & ((UBIDRV_UART_WRITE_BUFFER_SIZE) - 1)) != 0
+    #error "STM32CUBEF2__UBIDRV_UART_WRITE_BUFFER_SIZE must be a power of two"
+#endif
+#define UBIDRV_UART_STATS_ENABLE        STM32CUBEF2__UBIDRV_UART_STATS_ENABLE
+#define UBIDRV_UART_TX_DMA_LEN_MAX      (0xFFFF)
+#define UBIDRV_UART_TX_DMA_LEN_XONXOFF  (16)
+#define UBIDRV_UART_POLLED_SPIN_MAX     (1000000)
+
+#define UBIDRV_UART_XON                 (0x11)
+#define UBIDRV_UART_XOFF                (0x13)
+
+struct _ubidrv_uart_io_async_t;
 
 typedef struct _ubidrv_uart_file_t
 {
@@ -31,12 +61,28 @@ typedef struct _ubidrv_uart_file_t
     unsigned int  need_reset :1;
     unsigned int  need_rx_restart :1;
     unsigned int  need_tx_restart :1;
+    unsigned int  tx_polled :1;
+
+    unsigned int  rx_dma :1;
+    unsigned int  tx_dma :1;
+
+    unsigned int  read_acquired :1;
+    unsigned int  write_reserved :1;
+
+    unsigned int  rx_flow :2;
+    unsigned int  rx_flow_stopped :1;
+    unsigned int  tx_flow_paused :1;
+    unsigned int  tx_flow_held :1;
+    unsigned int  tx_flow_sending :1;
 
-    cbuf_pt read_cbuf;
-    cbuf_pt write_cbuf;
+    ubidrv_uart_ring_t read_ring;
+    ubidrv_uart_ring_t write_ring;
+
+    uint8_t rx_it_byte;
 
     sem_pt read_sem;
     sem_pt write_sem;
+    sem_pt space_sem;
 
     mutex_pt put_lock;
     mutex_pt get_lock;
@@ -46,10 +92,181 @@ typedef struct _ubidrv_uart_file_t
     unsigned int  tx_overflow_count;
     unsigned int  reset_count;
 
+    uint32_t irq_priority;
+
+    uint32_t rx_wake_threshold;
+    uint32_t rx_wake_timeoutms;
+    volatile uint32_t rx_wake_level;
+
+    volatile uint32_t tx_space_level;
+
+    struct _ubidrv_uart_io_async_t * volatile async_read_head;
+    struct _ubidrv_uart_io_async_t * async_read_tail;
+    struct _ubidrv_uart_io_async_t * volatile async_write_head;
+    struct _ubidrv_uart_io_async_t * async_write_tail;
+
+    volatile uint16_t poll_events;
+
+    uint32_t rx_flow_high;
+    uint32_t rx_flow_low;
+    GPIO_TypeDef * rts_port;
+    uint16_t rts_pin;
+    volatile uint8_t tx_flow_char;
+    uint8_t tx_flow_buf;
+
+#if (UBIDRV_UART_STATS_ENABLE == 1)
+    ubidrv_uart_stats_t stats;
+    volatile uint32_t stats_signal_cycles;
+    volatile uint8_t stats_signal_pending;
+    volatile uint8_t stats_reader_waiting;
+#endif
+
+    uint8_t * rx_dma_buf;
+    uint16_t rx_dma_size;
+    uint16_t rx_dma_pos;
+
+    uint16_t tx_dma_len;
+
     UART_HandleTypeDef * hal_uart;
 } ubidrv_uart_file_t;
 
-extern ubidrv_uart_file_t _g_ubidrv_uart_files[UBIDRV_UART_FILE_NUM];
+extern ubidrv_uart_file_t _g_ubidrv_uart_files[UBIDRV_UART_FILE_SLOT_NUM];
+
+/* Given by the isr callbacks when a port with queued asynchronous requests can make progress */
+extern sem_pt _g_ubidrv_uart_async_sem;
+
+/* Given by the isr callbacks on the events of interest of the port being polled */
+extern sem_pt _g_ubidrv_uart_poll_sem;
+
+void _ubidrv_uart_reset(int fd);
+void _ubidrv_uart_rx_start(int fd);
+void _ubidrv_uart_tx_start(int fd);
+void _ubidrv_uart_rx_flow_resume(int fd);
+
+/* Nothing is queued or on the wire, so a writer has to start transmission itself */
+static inline int _ubidrv_uart_tx_is_idle(ubidrv_uart_file_t * file)
+{
+    return _ubidrv_uart_ring_get_len(&file->write_ring) == 0 && !file->tx_flow_sending;
+}
+
+#if (UBIDRV_UART_STATS_ENABLE == 1)
+#define UBIDRV_UART_STATS_INC(file, field)      ((file)->stats.field++)
+#define UBIDRV_UART_STATS_ADD(file, field, n)   ((file)->stats.field += (n))
+#define UBIDRV_UART_STATS_MAX(file, field, n)   do { uint32_t _n = (n); if (_n > (file)->stats.field) { (file)->stats.field = _n; } } while (0)
+#else
+#define UBIDRV_UART_STATS_INC(file, field)      ((void) 0)
+#define UBIDRV_UART_STATS_ADD(file, field, n)   ((void) 0)
+#define UBIDRV_UART_STATS_MAX(file, field, n)   ((void) 0)
+#endif
+
+static inline uint32_t _ubidrv_uart_stats_cycles(void)
+{
+#if (UBIDRV_UART_STATS_ENABLE == 1)
+    return DWT->CYCCNT;
+#else
+    return 0;
+#endif
+}
+
+/* Mark a reader as blocked on the read semaphore, so that the isr stamps only signals that wake a sleeper */
+static inline void _ubidrv_uart_stats_wait(ubidrv_uart_file_t * file, sem_pt sem)
+{
+#if (UBIDRV_UART_STATS_ENABLE == 1)
+    uint32_t primask;
+
+    if (sem == file->read_sem)
+    {
+        primask = __get_PRIMASK();
+        __disable_irq();
+        file->stats_signal_pending = 0;
+        file->stats_reader_waiting = 1;
+        __set_PRIMASK(primask);
+    }
+#else
+    (void) file;
+    (void) sem;
+#endif
+}
+
+/* Account a wait on the read or write semaphore that started at t0 and ended with r, and the isr to reader latency
+ * of the read semaphore. A read wait that ended at once on a signal given before the reader blocked (or on a recovery
+ * signal) is not a wait and is not counted. */
+static inline void _ubidrv_uart_stats_waited(ubidrv_uart_file_t * file, sem_pt sem, uint32_t t0, int r)
+{
+#if (UBIDRV_UART_STATS_ENABLE == 1)
+    uint32_t now = _ubidrv_uart_stats_cycles();
+    uint32_t bucket;
+
+    if (sem == file->read_sem)
+    {
+        file->stats_reader_waiting = 0;
+        if (r == 0 && !file->stats_signal_pending)
+        {
+            return;
+        }
+        file->stats.read_wait_count++;
+        file->stats.read_wait_cycles += now - t0;
+        if (r == 0)
+        {
+            file->stats_signal_pending = 0;
+            bucket = 32 - __CLZ(now - file->stats_signal_cycles);
+            file->stats.wakeup_hist[min(bucket, UBIDRV_UART_STATS_HIST_SIZE - 1)]++;
+        }
+    }
+    else
+    {
+        file->stats.write_wait_count++;
+        file->stats.write_wait_cycles += now - t0;
+    }
+#else
+    (void) file;
+    (void) sem;
+    (void) t0;
+    (void) r;
+#endif
+}
+
+/* The isr callbacks signal waiters on every event that needs task level recovery (error, failed restart).
+ * UBIDRV_UART_CHECK_INTERVAL_MS only adds a periodic wake-up to untimed waits as a safety net (0 to disable it);
+ * timed waits sleep for the caller's timeout. */
+static inline int _ubidrv_uart_sem_take(ubidrv_uart_file_t * file, sem_pt sem)
+{
+    int r;
+    uint32_t t0 = _ubidrv_uart_stats_cycles();
+
+    _ubidrv_uart_stats_wait(file, sem);
+
+#if (UBIDRV_UART_CHECK_INTERVAL_MS > 0)
+    r = sem_take_timedms(sem, UBIDRV_UART_CHECK_INTERVAL_MS);
+#else
+    r = sem_take(sem);
+#endif
+
+    _ubidrv_uart_stats_waited(file, sem, t0, r);
+
+    return r;
+}
+
+static inline int _ubidrv_uart_sem_take_timedms(ubidrv_uart_file_t * file, sem_pt sem, uint32_t timeoutms)
+{
+    int r;
+    uint32_t t0 = _ubidrv_uart_stats_cycles();
+
+    _ubidrv_uart_stats_wait(file, sem);
+
+    r = sem_take_timedms(sem, timeoutms);
+
+    _ubidrv_uart_stats_waited(file, sem, t0, r);
+
+    return r;
+}
+
+/* Make the isr wake a reader once wanted bytes, or the rx wake threshold if smaller, are in the read buffer.
+ * Readers set it right before sleeping; 1 (wake on the first byte) otherwise. */
+static inline void _ubidrv_uart_set_rx_wake_level(ubidrv_uart_file_t * file, uint32_t wanted)
+{
+    file->rx_wake_level = max(1, min(wanted, file->rx_wake_threshold));
+}
 
 #ifdef __cplusplus
 }
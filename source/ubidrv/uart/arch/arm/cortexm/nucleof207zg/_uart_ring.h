@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2022 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _UART_RING_H_
+#define _UART_RING_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Single-producer/single-consumer byte ring between the uart isr and the task side.
+ *
+ * head and tail run freely and are masked on access, so the whole buffer is usable and the size must be a power of two.
+ * Only the producer writes tail and only the consumer writes head. Each side publishes its index after touching the data
+ * (release), and reads the other side's index before touching the data (acquire), so neither needs a critical section.
+ * Producers and consumers of the same side still have to be serialized by the caller (put_lock, get_lock).
+ * The indices are volatile and min() evaluates its arguments twice, so they are loaded into locals first.
+ */
+typedef struct _ubidrv_uart_ring_t
+{
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t mask;
+    uint8_t * buf;
+} ubidrv_uart_ring_t;
+
+static inline void _ubidrv_uart_ring_init(ubidrv_uart_ring_t * ring, uint8_t * buf, uint32_t size)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = size - 1;
+    ring->buf = buf;
+}
+
+static inline uint32_t _ubidrv_uart_ring_get_capacity(ubidrv_uart_ring_t * ring)
+{
+    return ring->mask + 1;
+}
+
+static inline uint32_t _ubidrv_uart_ring_get_len(ubidrv_uart_ring_t * ring)
+{
+    return ring->tail - ring->head;
+}
+
+static inline uint32_t _ubidrv_uart_ring_get_free_len(ubidrv_uart_ring_t * ring)
+{
+    return ring->mask + 1 - (ring->tail - ring->head);
+}
+
+static inline int _ubidrv_uart_ring_is_full(ubidrv_uart_ring_t * ring)
+{
+    return (ring->tail - ring->head) > ring->mask;
+}
+
+/* Address of the byte at the head (the next one to read) */
+static inline uint8_t * _ubidrv_uart_ring_get_head_addr(ubidrv_uart_ring_t * ring)
+{
+    return &ring->buf[ring->head & ring->mask];
+}
+
+/* Number of bytes that can be read from the head without wrapping */
+static inline uint32_t _ubidrv_uart_ring_get_head_contig_len(ubidrv_uart_ring_t * ring)
+{
+    uint32_t head = ring->head;
+    uint32_t len = ring->tail - head;
+
+    __DMB();
+
+    return min(len, ring->mask + 1 - (head & ring->mask));
+}
+
+/* Address of the byte at offset from the head, and how many of len bytes from there are contiguous */
+static inline uint8_t * _ubidrv_uart_ring_get_span(ubidrv_uart_ring_t * ring, uint32_t offset, uint32_t len, uint32_t * span_len)
+{
+    uint32_t pos = (ring->head + offset) & ring->mask;
+
+    __DMB();
+
+    if (span_len != NULL)
+    {
+        *span_len = min(len, ring->mask + 1 - pos);
+    }
+
+    return &ring->buf[pos];
+}
+
+/* Address of the free byte at offset from the tail, and how many of len bytes from there are contiguous */
+static inline uint8_t * _ubidrv_uart_ring_get_free_span(ubidrv_uart_ring_t * ring, uint32_t offset, uint32_t len, uint32_t * span_len)
+{
+    uint32_t pos = (ring->tail + offset) & ring->mask;
+
+    __DMB();
+
+    if (span_len != NULL)
+    {
+        *span_len = min(len, ring->mask + 1 - pos);
+    }
+
+    return &ring->buf[pos];
+}
+
+/* Producer: copy up to len bytes in (data NULL to commit bytes already put in the free span) and publish them.
+ * Returns the number of bytes written. */
+static inline uint32_t _ubidrv_uart_ring_write(ubidrv_uart_ring_t * ring, const uint8_t * data, uint32_t len)
+{
+    uint32_t tail = ring->tail;
+    uint32_t space = ring->mask + 1 - (tail - ring->head);
+    uint32_t pos = tail & ring->mask;
+    uint32_t first;
+
+    len = min(len, space);
+
+    /* The consumer is done with the slots up to head */
+    __DMB();
+
+    if (data != NULL && len > 0)
+    {
+        first = min(len, ring->mask + 1 - pos);
+        memcpy(&ring->buf[pos], data, first);
+        memcpy(ring->buf, data + first, len - first);
+    }
+
+    /* The data is in place before the consumer can see it */
+    __DMB();
+    ring->tail = tail + len;
+
+    return len;
+}
+
+/* Consumer: copy up to len bytes out (data NULL to drop them) and release their slots.
+ * Returns the number of bytes read. */
+static inline uint32_t _ubidrv_uart_ring_read(ubidrv_uart_ring_t * ring, uint8_t * data, uint32_t len)
+{
+    uint32_t head = ring->head;
+    uint32_t avail = ring->tail - head;
+    uint32_t pos = head & ring->mask;
+    uint32_t first;
+
+    len = min(len, avail);
+
+    /* The producer's data up to tail is in place */
+    __DMB();
+
+    if (data != NULL && len > 0)
+    {
+        first = min(len, ring->mask + 1 - pos);
+        memcpy(data, &ring->buf[pos], first);
+        memcpy(data + first, ring->buf, len - first);
+    }
+
+    /* The data is copied out before the producer can reuse the slots */
+    __DMB();
+    ring->head = head + len;
+
+    return len;
+}
+
+/* Consumer: drop everything published so far */
+static inline void _ubidrv_uart_ring_clear(ubidrv_uart_ring_t * ring)
+{
+    __DMB();
+    ring->head = ring->tail;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _UART_RING_H_ */
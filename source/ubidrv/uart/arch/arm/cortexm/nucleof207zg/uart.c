@@ -16,39 +16,134 @@
 #include <ubinos/ubidrv/uart.h>
 #include <ubinos/bsp/arch.h>
 
+#include <stm32cubef2_extension/ubidrv/uart.h>
+
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "main.h"
 
+#include "_uart_ring.h"
 #include "_uart.h"
 
-static const char * _g_ubidrv_uart_file_names[UBIDRV_UART_FILE_NUM] =
+/* /dev/ttyN uses UBIDRV_UART_UARTN and UBIDRV_UART_UARTN_IRQn of main.h. Ports whose instance is not defined cannot be opened. */
+static USART_TypeDef * const _g_ubidrv_uart_file_instance[UBIDRV_UART_FILE_SLOT_NUM] =
 {
-    "/dev/tty1",
-    "/dev/tty2",
+#if (UBIDRV_UART_FILE_NUM >= 1) && defined(UBIDRV_UART_UART1)
+    [0] = UBIDRV_UART_UART1,
+#endif
+#if (UBIDRV_UART_FILE_NUM >= 2) && defined(UBIDRV_UART_UART2)
+    [1] = UBIDRV_UART_UART2,
+#endif
+#if (UBIDRV_UART_FILE_NUM >= 3) && defined(UBIDRV_UART_UART3)
+    [2] = UBIDRV_UART_UART3,
+#endif
+#if (UBIDRV_UART_FILE_NUM >= 4) && defined(UBIDRV_UART_UART4)
+    [3] = UBIDRV_UART_UART4,
+#endif
+#if (UBIDRV_UART_FILE_NUM >= 5) && defined(UBIDRV_UART_UART5)
+    [4] = UBIDRV_UART_UART5,
+#endif
+#if (UBIDRV_UART_FILE_NUM >= 6) && defined(UBIDRV_UART_UART6)
+    [5] = UBIDRV_UART_UART6,
+#endif
+#if defined(UBIDRV_UART_CONSOLE_FD)
+    [UBIDRV_UART_CONSOLE_FD - 1] = DTTY_STM32_UART,
+#endif
 };
 
-static USART_TypeDef * _g_ubidrv_uart_file_instance[UBIDRV_UART_FILE_NUM] =
+static const IRQn_Type _g_ubidrv_uart_file_irqn[UBIDRV_UART_FILE_SLOT_NUM] =
 {
-    UBIDRV_UART_UART1,
-    UBIDRV_UART_UART2,
+#if (UBIDRV_UART_FILE_NUM >= 1) && defined(UBIDRV_UART_UART1)
+    [0] = UBIDRV_UART_UART1_IRQn,
+#endif
+#if (UBIDRV_UART_FILE_NUM >= 2) && defined(UBIDRV_UART_UART2)
+    [1] = UBIDRV_UART_UART2_IRQn,
+#endif
+#if (UBIDRV_UART_FILE_NUM >= 3) && defined(UBIDRV_UART_UART3)
+    [2] = UBIDRV_UART_UART3_IRQn,
+#endif
+#if (UBIDRV_UART_FILE_NUM >= 4) && defined(UBIDRV_UART_UART4)
+    [3] = UBIDRV_UART_UART4_IRQn,
+#endif
+#if (UBIDRV_UART_FILE_NUM >= 5) && defined(UBIDRV_UART_UART5)
+    [4] = UBIDRV_UART_UART5_IRQn,
+#endif
+#if (UBIDRV_UART_FILE_NUM >= 6) && defined(UBIDRV_UART_UART6)
+    [5] = UBIDRV_UART_UART6_IRQn,
+#endif
+#if defined(UBIDRV_UART_CONSOLE_FD)
+    [UBIDRV_UART_CONSOLE_FD - 1] = DTTY_STM32_UART_IRQn,
+#endif
 };
 
-UART_HandleTypeDef _g_ubidrv_uart_handle[UBIDRV_UART_FILE_NUM];
+UART_HandleTypeDef _g_ubidrv_uart_handle[UBIDRV_UART_FILE_SLOT_NUM];
+
+ubidrv_uart_file_t _g_ubidrv_uart_files[UBIDRV_UART_FILE_SLOT_NUM];
 
-ubidrv_uart_file_t _g_ubidrv_uart_files[UBIDRV_UART_FILE_NUM];
+sem_pt _g_ubidrv_uart_async_sem = NULL;
 
-static void _ubidrv_uart_reset(int fd);
-static ubi_st_t _ubidrv_uart_init(int fd);
+sem_pt _g_ubidrv_uart_poll_sem = NULL;
+static volatile uint8_t _g_ubidrv_uart_poll_busy = 0;
+
+static int _ubidrv_uart_get_file_index(const char * file_name);
+static ubi_st_t _ubidrv_uart_init(int fd, const ubidrv_uart_ext_t * ext);
+static void _ubidrv_uart_rx_flow_marks(const ubidrv_uart_ext_t * ext, uint32_t * high, uint32_t * low);
+static void _ubidrv_uart_rx_flow_apply(int fd);
+static void _ubidrv_uart_rx_flow_signal(int fd, int stop);
+static void _ubidrv_uart_rx_flow_check(int fd);
+static int _ubidrv_uart_tx_flow_take(int fd, uint8_t ch);
+static void _ubidrv_uart_rx_dma_push(int fd, uint8_t * buf, uint16_t len);
+static void _ubidrv_uart_rx_signal(ubidrv_uart_file_t * file, uint32_t len_before, int idle);
 static ubi_st_t _ubidrv_uart_getc_advan(int fd, char *ch_p, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static ubi_st_t _ubidrv_uart_putn_advan(int fd, const char *str, int len);
+static ubi_st_t _ubidrv_uart_getline_advan(int fd, char *str, uint32_t max, ubidrv_uart_line_term_t term, uint32_t *len, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static int _ubidrv_uart_is_line_term(ubidrv_uart_line_term_t term, char prev, char ch);
+static uint32_t _ubidrv_uart_poll_check(ubidrv_uart_pollfd_t * fds, uint32_t nfds);
+static ubi_st_t _ubidrv_uart_poll_advan(ubidrv_uart_pollfd_t * fds, uint32_t nfds, uint32_t * nready, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static ubi_st_t _ubidrv_uart_put_polled(USART_TypeDef * usart, const uint8_t * data, uint32_t len);
+
+static int _ubidrv_uart_get_file_index(const char * file_name)
+{
+    int index = 0;
+    const char * p;
+
+#if defined(UBIDRV_UART_CONSOLE_FD)
+    if (0 == strncmp(file_name, UBIDRV_UART_CONSOLE_FILE_NAME, UBIDRV_UART_FILE_NAME_MAX))
+    {
+        return UBIDRV_UART_CONSOLE_FD - 1;
+    }
+#endif
+
+    if (0 != strncmp(file_name, UBIDRV_UART_FILE_NAME_PREFIX, sizeof(UBIDRV_UART_FILE_NAME_PREFIX) - 1))
+    {
+        return -1;
+    }
+
+    for (p = &file_name[sizeof(UBIDRV_UART_FILE_NAME_PREFIX) - 1]; p < &file_name[UBIDRV_UART_FILE_NAME_MAX] && *p != '\0'; p++)
+    {
+        if (*p < '0' || *p > '9' || index > UBIDRV_UART_FILE_NUM)
+        {
+            return -1;
+        }
+        index = index * 10 + (*p - '0');
+    }
+
+    if (index < 1 || index > UBIDRV_UART_FILE_NUM)
+    {
+        return -1;
+    }
+
+    return index - 1;
+}
 
-static void _ubidrv_uart_reset(int fd)
+void _ubidrv_uart_reset(int fd)
 {
     HAL_StatusTypeDef stm_err;
     (void) stm_err;
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
 
@@ -62,11 +157,18 @@ static void _ubidrv_uart_reset(int fd)
         file->need_reset = 0;
         file->need_tx_restart = 1;
         file->need_rx_restart = 1;
+        file->tx_polled = 0;
 
         stm_err = HAL_UART_Init(file->hal_uart);
         ubi_assert(stm_err == HAL_OK);
 
-        HAL_NVIC_SetPriority(UBIDRV_UART_UART1_IRQn, NVIC_PRIO_MIDDLE, 0);
+        HAL_NVIC_SetPriority(_g_ubidrv_uart_file_irqn[fd - 1], file->irq_priority, 0);
+
+        file->tx_flow_paused = 0;
+        file->tx_flow_held = 0;
+        file->tx_flow_sending = 0;
+        file->tx_flow_char = 0;
+        _ubidrv_uart_rx_flow_apply(fd);
 
         file->reset_count++;
     }
@@ -74,14 +176,13 @@ static void _ubidrv_uart_reset(int fd)
     mutex_unlock(file->reset_lock);
 }
 
-static ubi_st_t _ubidrv_uart_init(int fd)
+static ubi_st_t _ubidrv_uart_init(int fd, const ubidrv_uart_ext_t * ext)
 {
     int r;
     ubi_st_t ubi_err;
     uint8_t * buf;
-    uint16_t len;
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
 
     do
@@ -106,14 +207,36 @@ static ubi_st_t _ubidrv_uart_init(int fd)
 
         file->in_init = 1;
 
-        r = cbuf_create(&file->read_cbuf, UBIDRV_UART_READ_BUFFER_SIZE);
-        ubi_assert(r == 0);
-        r = cbuf_create(&file->write_cbuf, UBIDRV_UART_WRITE_BUFFER_SIZE);
-        ubi_assert(r == 0);
+        buf = ext->read_buffer;
+        if (buf == NULL)
+        {
+            buf = malloc(ext->read_buffer_size);
+            ubi_assert(buf != NULL);
+        }
+        _ubidrv_uart_ring_init(&file->read_ring, buf, ext->read_buffer_size);
+        buf = ext->write_buffer;
+        if (buf == NULL)
+        {
+            buf = malloc(ext->write_buffer_size);
+            ubi_assert(buf != NULL);
+        }
+        _ubidrv_uart_ring_init(&file->write_ring, buf, ext->write_buffer_size);
         r = semb_create(&file->read_sem);
         ubi_assert(r == 0);
         r = semb_create(&file->write_sem);
         ubi_assert(r == 0);
+        r = semb_create(&file->space_sem);
+        ubi_assert(r == 0);
+        if (_g_ubidrv_uart_async_sem == NULL)
+        {
+            r = semb_create(&_g_ubidrv_uart_async_sem);
+            ubi_assert(r == 0);
+        }
+        if (_g_ubidrv_uart_poll_sem == NULL)
+        {
+            r = semb_create(&_g_ubidrv_uart_poll_sem);
+            ubi_assert(r == 0);
+        }
         r = mutex_create(&file->reset_lock);
         ubi_assert(r == 0);
         r = mutex_create(&file->put_lock);
@@ -121,28 +244,71 @@ static ubi_st_t _ubidrv_uart_init(int fd)
         r = mutex_create(&file->get_lock);
         ubi_assert(r == 0);
 
+        file->rx_dma = 0;
+        if (ext->rx_mode == UBIDRV_UART_RX_MODE_DMA && file->hal_uart->hdmarx != NULL && ext->rx_dma_buffer_size > 0)
+        {
+            file->rx_dma_size = ext->rx_dma_buffer_size;
+            file->rx_dma_buf = malloc(file->rx_dma_size);
+            ubi_assert(file->rx_dma_buf != NULL);
+            file->rx_dma = 1;
+        }
+        file->rx_dma_pos = 0;
+
+        file->tx_dma = 0;
+        if (ext->tx_mode == UBIDRV_UART_TX_MODE_DMA && file->hal_uart->hdmatx != NULL)
+        {
+            file->tx_dma = 1;
+        }
+        file->tx_dma_len = 0;
+        file->tx_polled = 0;
+
         file->echo = 0;
         file->autocr = 0;
 
+        file->rx_wake_threshold = 1;
+        file->rx_wake_timeoutms = 0;
+        file->rx_wake_level = 1;
+
+        file->tx_space_level = 0;
+
+        file->async_read_head = NULL;
+        file->async_read_tail = NULL;
+        file->async_write_head = NULL;
+        file->async_write_tail = NULL;
+
+        file->poll_events = 0;
+
+        file->rx_flow = ext->rx_flow;
+        _ubidrv_uart_rx_flow_marks(ext, &file->rx_flow_high, &file->rx_flow_low);
+        file->rts_port = (GPIO_TypeDef *) ext->rts_port;
+        file->rts_pin = ext->rts_pin;
+        file->rx_flow_stopped = 0;
+        file->tx_flow_paused = 0;
+        file->tx_flow_held = 0;
+        file->tx_flow_sending = 0;
+        file->tx_flow_char = 0;
+
         file->rx_overflow_count = 0;
         file->tx_overflow_count = 0;
         file->need_reset = 1;
 
+#if (UBIDRV_UART_STATS_ENABLE == 1)
+        memset(&file->stats, 0, sizeof(file->stats));
+        file->stats_signal_pending = 0;
+        file->stats_reader_waiting = 0;
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
         file->init = 1;
 
         _ubidrv_uart_reset(fd);
 
         file->reset_count = 0;
 
-        cbuf_clear(file->read_cbuf);
+        _ubidrv_uart_ring_clear(&file->read_ring);
 
-        buf = cbuf_get_tail_addr(file->read_cbuf);
-        len = 1;
-        file->need_rx_restart = 0;
-        if (HAL_UART_Receive_IT(file->hal_uart, buf, len) != HAL_OK)
-        {
-            file->need_rx_restart = 1;
-        }
+        _ubidrv_uart_rx_start(fd);
 
         file->in_init = 0;
 
@@ -157,11 +323,9 @@ static ubi_st_t _ubidrv_uart_getc_advan(int fd, char *ch_p, uint16_t io_option,
 {
     int r;
     ubi_st_t ubi_err;
-    uint8_t * buf;
-    uint16_t len;
     uint32_t _remain_timeoutms = timeoutms;
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
 
@@ -217,19 +381,13 @@ static ubi_st_t _ubidrv_uart_getc_advan(int fd, char *ch_p, uint16_t io_option,
 
             if (file->need_rx_restart)
             {
-                len = 1;
-
-                buf = cbuf_get_tail_addr(file->read_cbuf);
-                file->need_rx_restart = 0;
-                if (HAL_UART_Receive_IT(file->hal_uart, buf, len) != HAL_OK)
-                {
-                    file->need_rx_restart = 1;
-                }
+                _ubidrv_uart_rx_start(fd);
             }
 
-            ubi_err = cbuf_read(file->read_cbuf, (uint8_t*) ch_p, 1, NULL);
-            if (ubi_err == UBI_ST_OK)
+            if (_ubidrv_uart_ring_read(&file->read_ring, (uint8_t*) ch_p, 1) == 1)
             {
+                ubi_err = UBI_ST_OK;
+                _ubidrv_uart_rx_flow_resume(fd);
                 break;
             }
             else
@@ -245,7 +403,7 @@ static ubi_st_t _ubidrv_uart_getc_advan(int fd, char *ch_p, uint16_t io_option,
                         ubi_err = UBI_ST_TIMEOUT;
                         break;
                     }
-                    sem_take_timedms(file->read_sem, min(_remain_timeoutms, UBIDRV_UART_CHECK_INTERVAL_MS));
+                    _ubidrv_uart_sem_take_timedms(file, file->read_sem, _remain_timeoutms);
                     _remain_timeoutms = task_getremainingtimeoutms();
                     if (NULL != remain_timeoutms)
                     {
@@ -254,7 +412,7 @@ static ubi_st_t _ubidrv_uart_getc_advan(int fd, char *ch_p, uint16_t io_option,
                     ubi_err = UBI_ST_OK;
                     break;
                 case UBIDEV_UART_IO_OPTION__BLOCKED:
-                    sem_take_timedms(file->read_sem, UBIDRV_UART_CHECK_INTERVAL_MS);
+                    _ubidrv_uart_sem_take(file, file->read_sem);
                     ubi_err = UBI_ST_OK;
                     break;
                 }
@@ -278,148 +436,920 @@ static ubi_st_t _ubidrv_uart_getc_advan(int fd, char *ch_p, uint16_t io_option,
     return ubi_err;
 }
 
-void ubidrv_uart_rx_callback(int fd)
+static int _ubidrv_uart_is_line_term(ubidrv_uart_line_term_t term, char prev, char ch)
 {
-    uint8_t *buf;
-    uint16_t len;
-    int need_signal = 0;
+    switch (term)
+    {
+    case UBIDRV_UART_LINE_TERM_CR:
+        return ('\r' == ch);
+    case UBIDRV_UART_LINE_TERM_LF:
+        return ('\n' == ch);
+    case UBIDRV_UART_LINE_TERM_CRLF:
+        return ('\r' == prev && '\n' == ch);
+    default:
+    case UBIDRV_UART_LINE_TERM_ANY:
+        return ('\0' == ch || '\n' == ch || '\r' == ch);
+    }
+}
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+static ubi_st_t _ubidrv_uart_getline_advan(int fd, char *str, uint32_t max, ubidrv_uart_line_term_t term, uint32_t *len, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t ubi_err;
+    uint32_t _remain_timeoutms = timeoutms;
+    uint32_t line_len = 0;
+    uint32_t buffered;
+    uint32_t room;
+    uint32_t n;
+    int found;
+    char prev;
+    char ch;
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
+    ubi_assert(str != NULL && max > 0);
 
     do
     {
-        if (file->hal_uart->ErrorCode != HAL_UART_ERROR_NONE)
+        if (bsp_isintr() || 0 != _bsp_critcount)
         {
+            ubi_err = UBI_ST_ERR_INVALID_STATE;
             break;
         }
 
-        if (file->need_reset)
+        if (!_bsp_kernel_active)
         {
+            ubi_err = UBI_ST_ERR_INVALID_STATE;
             break;
         }
 
-        if (file->need_rx_restart)
+        if (!file->init)
         {
-            bsp_abortsystem();
+            ubi_err = UBI_ST_ERR_INIT;
+            break;
         }
 
-        len = 1;
+        switch (io_option)
+        {
+        case UBIDEV_UART_IO_OPTION__TIMED:
+            r = mutex_lock_timedms(file->get_lock, timeoutms);
+            _remain_timeoutms = task_getremainingtimeoutms();
+            if (NULL != remain_timeoutms)
+            {
+                *remain_timeoutms = _remain_timeoutms;
+            }
+            break;
+        default:
+        case UBIDEV_UART_IO_OPTION__BLOCKED:
+            r = mutex_lock(file->get_lock);
+            break;
+        }
 
-        if (cbuf_is_full(file->read_cbuf))
+        if (r != 0)
         {
-            file->rx_overflow_count++;
+            ubi_err = UBI_ST_BUSY;
+            break;
         }
-        else
+
+        /* Scan the buffered bytes in place and move everything up to the terminator out with one ring read.
+         * A partial line is moved out before sleeping, so that the next received byte signals read_sem again. */
+        prev = '\0';
+        for (;;)
         {
-            if (cbuf_get_len(file->read_cbuf) == 0)
+            if (file->need_reset)
+            {
+                _ubidrv_uart_reset(fd);
+            }
+
+            if (file->need_rx_restart)
+            {
+                _ubidrv_uart_rx_start(fd);
+            }
+
+            buffered = _ubidrv_uart_ring_get_len(&file->read_ring);
+            room = max - 1 - line_len;
+            found = 0;
+            for (n = 0; n < buffered; n++)
+            {
+                ch = *_ubidrv_uart_ring_get_span(&file->read_ring, n, 1, NULL);
+                if (_ubidrv_uart_is_line_term(term, prev, ch))
+                {
+                    found = 1;
+                    break;
+                }
+                if (n == room)
+                {
+                    break;
+                }
+                prev = ch;
+            }
+
+            if (n > 0)
             {
-                need_signal = 1;
+                _ubidrv_uart_ring_read(&file->read_ring, (uint8_t *) &str[line_len], n);
+                _ubidrv_uart_rx_flow_resume(fd);
+                if (0 != file->echo)
+                {
+                    _ubidrv_uart_putn_advan(fd, &str[line_len], n);
+                }
+                line_len += n;
+            }
+
+            if (found)
+            {
+                _ubidrv_uart_ring_read(&file->read_ring, (uint8_t *) &ch, 1);
+                _ubidrv_uart_rx_flow_resume(fd);
+                if (0 != file->echo)
+                {
+                    _ubidrv_uart_putn_advan(fd, &ch, 1);
+                }
+                if (UBIDRV_UART_LINE_TERM_CRLF == term)
+                {
+                    line_len--;
+                }
+                ubi_err = UBI_ST_OK;
+                break;
             }
 
-            cbuf_write(file->read_cbuf, NULL, len, NULL);
+            if (line_len == max - 1)
+            {
+                ubi_err = UBI_ST_OK;
+                break;
+            }
 
-            if (need_signal && _bsp_kernel_active)
+            if (UBIDEV_UART_IO_OPTION__TIMED == io_option)
+            {
+                if (_remain_timeoutms <= 0)
+                {
+                    ubi_err = UBI_ST_TIMEOUT;
+                    break;
+                }
+                _ubidrv_uart_sem_take_timedms(file, file->read_sem, _remain_timeoutms);
+                _remain_timeoutms = task_getremainingtimeoutms();
+                if (NULL != remain_timeoutms)
+                {
+                    *remain_timeoutms = _remain_timeoutms;
+                }
+            }
+            else
             {
-                sem_give(file->read_sem);
+                _ubidrv_uart_sem_take(file, file->read_sem);
             }
         }
 
-        buf = cbuf_get_tail_addr(file->read_cbuf);
-        file->need_rx_restart = 0;
-        if (HAL_UART_Receive_IT(file->hal_uart, buf, len) != HAL_OK)
+        str[line_len] = '\0';
+        if (NULL != len)
         {
-            file->need_rx_restart = 1;
-            break;
+            *len = line_len;
         }
-    } while (0);
+
+        mutex_unlock(file->get_lock);
+
+        break;
+    } while (1);
+
+    return ubi_err;
 }
 
-void ubidrv_uart_tx_callback(int fd)
+static ubi_st_t _ubidrv_uart_putn_advan(int fd, const char *str, int len)
 {
-    uint8_t *buf;
-    uint16_t len;
+    ubi_st_t ubi_err;
+    const char * end;
+    const char * nl;
+    uint32_t run;
+    uint32_t written;
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
 
     do
     {
-        if (file->hal_uart->ErrorCode != HAL_UART_ERROR_NONE)
+        if (bsp_isintr() || 0 != _bsp_critcount)
         {
+            ubi_err = UBI_ST_ERR_INVALID_STATE;
             break;
         }
 
-        if (file->need_reset)
+        if (!_bsp_kernel_active)
         {
+            ubi_err = UBI_ST_ERR_INVALID_STATE;
             break;
         }
 
-        if (file->need_tx_restart)
+        if (!file->init)
         {
-            bsp_abortsystem();
+            ubi_err = UBI_ST_ERR_INIT;
+            break;
         }
 
-        len = 1;
-
-        cbuf_read(file->write_cbuf, NULL, len, NULL);
+        mutex_lock(file->put_lock);
 
-        if (cbuf_get_len(file->write_cbuf) == 0)
+        do
         {
-            if (_bsp_kernel_active)
+            if (file->need_reset)
             {
-                sem_give(file->write_sem);
+                _ubidrv_uart_reset(fd);
             }
-            file->need_tx_restart = 1;
-            break;
-        }
 
-        buf = cbuf_get_head_addr(file->write_cbuf);
-        file->need_tx_restart = 0;
-        if (HAL_UART_Transmit_IT(file->hal_uart, buf, len) != HAL_OK)
-        {
-            file->need_tx_restart = 1;
+            if (_ubidrv_uart_tx_is_idle(file))
+            {
+                sem_clear(file->write_sem);
+                file->need_tx_restart = 1;
+            }
+
+            /* Copy the runs between newlines as whole spans, expanding each newline to CR LF when autocr is set. */
+            end = str + len;
+            while (str < end)
+            {
+                nl = (0 != file->autocr) ? memchr(str, '\n', end - str) : NULL;
+                run = ((nl != NULL) ? nl : end) - str;
+
+                if (run > 0)
+                {
+                    written = _ubidrv_uart_ring_write(&file->write_ring, (const uint8_t *) str, run);
+                    str += written;
+                    if (written < run)
+                    {
+                        break;
+                    }
+                }
+
+                if (nl != NULL)
+                {
+                    if (_ubidrv_uart_ring_get_free_len(&file->write_ring) < 2)
+                    {
+                        break;
+                    }
+                    _ubidrv_uart_ring_write(&file->write_ring, (const uint8_t *) "\r\n", 2);
+                    str++;
+                }
+            }
+            if (str < end)
+            {
+                file->tx_overflow_count += end - str;
+            }
+
+            if (file->need_tx_restart && _ubidrv_uart_ring_get_len(&file->write_ring) > 0)
+            {
+                _ubidrv_uart_tx_start(fd);
+                if (file->need_tx_restart)
+                {
+                    ubi_err = UBI_ST_BUSY;
+                    break;
+                }
+            }
+
+            ubi_err = UBI_ST_OK;
             break;
-        }
-    } while (0);
+        } while (1);
+
+        mutex_unlock(file->put_lock);
+
+        break;
+    } while (1);
+
+    return ubi_err;
 }
 
-void ubidrv_uart_err_callback(int fd)
+void _ubidrv_uart_rx_start(int fd)
 {
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    HAL_StatusTypeDef stm_err;
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
-    ubi_assert(file->init == 1);
 
-    file->need_reset = 1;
+    file->need_rx_restart = 0;
+    if (file->rx_dma)
+    {
+        file->rx_dma_pos = 0;
+        stm_err = HAL_UARTEx_ReceiveToIdle_DMA(file->hal_uart, file->rx_dma_buf, file->rx_dma_size);
+    }
+    else
+    {
+        stm_err = HAL_UART_Receive_IT(file->hal_uart, &file->rx_it_byte, 1);
+    }
+    if (stm_err != HAL_OK)
+    {
+        file->need_rx_restart = 1;
+    }
 }
 
-
-ubi_st_t ubidrv_uart_open(ubidrv_uart_t * uart)
+/* Start sending a pending flow control character or the write buffer if the transmitter is idle.
+ * Called from tasks and isrs alike: the check and the start are done with interrupts disabled, so only one of them
+ * starts a transfer, and a transfer in flight picks up what is pending from its completion callback. */
+void _ubidrv_uart_tx_start(int fd)
 {
-    ubi_st_t ubi_err;
-    ubidrv_uart_file_t * file = NULL;
+    HAL_StatusTypeDef stm_err;
+    uint32_t len;
+    uint32_t primask;
 
-    ubi_assert(uart != NULL);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+
+    file->need_tx_restart = 0;
+    if (file->need_reset)
+    {
+        /* Started again once the port is reset */
+        stm_err = HAL_ERROR;
+    }
+    else if (file->hal_uart->gState != HAL_UART_STATE_READY)
+    {
+        /* Busy with a transfer whose completion starts the next one */
+        stm_err = HAL_OK;
+    }
+    else if (file->tx_flow_char != 0)
+    {
+        /* A flow control character goes ahead of the write buffer */
+        file->tx_flow_buf = file->tx_flow_char;
+        file->tx_flow_char = 0;
+        file->tx_flow_sending = 1;
+        stm_err = HAL_UART_Transmit_IT(file->hal_uart, &file->tx_flow_buf, 1);
+        if (stm_err != HAL_OK)
+        {
+            file->tx_flow_sending = 0;
+            file->tx_flow_char = file->tx_flow_buf;
+        }
+    }
+    else if (_ubidrv_uart_ring_get_len(&file->write_ring) == 0)
+    {
+        /* Nothing to send: left idle for the next writer to start */
+        stm_err = HAL_ERROR;
+    }
+    else if (file->tx_flow_paused)
+    {
+        /* Stopped by XOFF from the peer, to be started again on XON */
+        file->tx_flow_held = 1;
+        stm_err = HAL_OK;
+    }
+    else if (file->tx_dma)
+    {
+        len = min(_ubidrv_uart_ring_get_head_contig_len(&file->write_ring), UBIDRV_UART_TX_DMA_LEN_MAX);
+        if (file->rx_flow == UBIDRV_UART_RX_FLOW_XONXOFF)
+        {
+            /* Keep bursts short so that XOFF from the peer takes effect soon */
+            len = min(len, UBIDRV_UART_TX_DMA_LEN_XONXOFF);
+        }
+        file->tx_dma_len = len;
+        stm_err = HAL_UART_Transmit_DMA(file->hal_uart, _ubidrv_uart_ring_get_head_addr(&file->write_ring), len);
+    }
+    else
+    {
+        stm_err = HAL_UART_Transmit_IT(file->hal_uart, _ubidrv_uart_ring_get_head_addr(&file->write_ring), 1);
+    }
+    if (stm_err != HAL_OK)
+    {
+        file->need_tx_restart = 1;
+    }
+
+    __set_PRIMASK(primask);
+}
+
+static void _ubidrv_uart_rx_flow_marks(const ubidrv_uart_ext_t * ext, uint32_t * high, uint32_t * low)
+{
+    *high = (ext->rx_flow_high != 0) ? ext->rx_flow_high : (ext->read_buffer_size - ext->read_buffer_size / 4);
+    *low = (ext->rx_flow_low != 0) ? ext->rx_flow_low : (ext->read_buffer_size / 4);
+}
+
+/* Bring the flow control lines in line with rx_flow_stopped after the peripheral is (re)initialized */
+static void _ubidrv_uart_rx_flow_apply(int fd)
+{
+    GPIO_InitTypeDef gpio_init = { 0 };
+
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+
+    switch (file->rx_flow)
+    {
+    case UBIDRV_UART_RX_FLOW_RTS:
+        /* HAL_UART_Init may have muxed the pin to the peripheral */
+        HAL_GPIO_WritePin(file->rts_port, file->rts_pin, file->rx_flow_stopped ? GPIO_PIN_SET : GPIO_PIN_RESET);
+        gpio_init.Pin = file->rts_pin;
+        gpio_init.Mode = GPIO_MODE_OUTPUT_PP;
+        gpio_init.Pull = GPIO_NOPULL;
+        gpio_init.Speed = GPIO_SPEED_FREQ_LOW;
+        HAL_GPIO_Init(file->rts_port, &gpio_init);
+        break;
+    case UBIDRV_UART_RX_FLOW_XONXOFF:
+        if (file->rx_flow_stopped)
+        {
+            file->tx_flow_char = UBIDRV_UART_XOFF;
+            _ubidrv_uart_tx_start(fd);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* Stop or resume the sender. Called from the isr, or with the critical section held. */
+static void _ubidrv_uart_rx_flow_signal(int fd, int stop)
+{
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+
+    file->rx_flow_stopped = stop;
+
+    switch (file->rx_flow)
+    {
+    case UBIDRV_UART_RX_FLOW_RTS:
+        HAL_GPIO_WritePin(file->rts_port, file->rts_pin, stop ? GPIO_PIN_SET : GPIO_PIN_RESET);
+        break;
+    case UBIDRV_UART_RX_FLOW_XONXOFF:
+        if (!stop && file->tx_flow_char == UBIDRV_UART_XOFF)
+        {
+            /* XOFF has not been sent yet */
+            file->tx_flow_char = 0;
+            break;
+        }
+        file->tx_flow_char = stop ? UBIDRV_UART_XOFF : UBIDRV_UART_XON;
+        /* Sent right away if the transmitter is idle, or after the transfer in flight otherwise */
+        file->tx_flow_held = 0;
+        _ubidrv_uart_tx_start(fd);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Stop the sender once the read buffer reaches the high-water mark (isr) */
+static void _ubidrv_uart_rx_flow_check(int fd)
+{
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+
+    if (file->rx_flow != UBIDRV_UART_RX_FLOW_NONE && !file->rx_flow_stopped && _ubidrv_uart_ring_get_len(&file->read_ring) >= file->rx_flow_high)
+    {
+        _ubidrv_uart_rx_flow_signal(fd, 1);
+    }
+}
+
+/* Resume the sender once the read buffer drains to the low-water mark (task, after taking data out) */
+void _ubidrv_uart_rx_flow_resume(int fd)
+{
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+
+    if (!file->rx_flow_stopped)
+    {
+        return;
+    }
+
+    ubik_entercrit();
+
+    if (file->rx_flow_stopped && _ubidrv_uart_ring_get_len(&file->read_ring) <= file->rx_flow_low)
+    {
+        _ubidrv_uart_rx_flow_signal(fd, 0);
+    }
+
+    ubik_exitcrit();
+}
+
+/* Take XON/XOFF received from the peer (isr). Returns 1 when ch is one of them. */
+static int _ubidrv_uart_tx_flow_take(int fd, uint8_t ch)
+{
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+
+    if (ch == UBIDRV_UART_XOFF)
+    {
+        file->tx_flow_paused = 1;
+        return 1;
+    }
+
+    if (ch == UBIDRV_UART_XON)
+    {
+        file->tx_flow_paused = 0;
+        if (file->tx_flow_held)
+        {
+            file->tx_flow_held = 0;
+            _ubidrv_uart_tx_start(fd);
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+static void _ubidrv_uart_rx_dma_push(int fd, uint8_t * buf, uint16_t len)
+{
+    uint32_t written = 0;
+    uint16_t run;
+
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+
+    while (len > 0)
+    {
+        run = len;
+        if (file->rx_flow == UBIDRV_UART_RX_FLOW_XONXOFF)
+        {
+            for (run = 0; run < len && buf[run] != UBIDRV_UART_XON && buf[run] != UBIDRV_UART_XOFF; run++)
+            {
+            }
+        }
+
+        if (run > 0)
+        {
+            written = _ubidrv_uart_ring_write(&file->read_ring, buf, run);
+            UBIDRV_UART_STATS_ADD(file, rx_bytes, written);
+            if (written < run)
+            {
+                file->rx_overflow_count += run - written;
+            }
+        }
+
+        if (run < len)
+        {
+            _ubidrv_uart_tx_flow_take(fd, buf[run]);
+            run++;
+        }
+
+        buf += run;
+        len -= run;
+    }
+}
+
+/* Wake the reader when the read buffer fills up to its wake level, or on an IDLE line with less buffered */
+static void _ubidrv_uart_rx_signal(ubidrv_uart_file_t * file, uint32_t len_before, int idle)
+{
+    uint32_t len = _ubidrv_uart_ring_get_len(&file->read_ring);
+    uint32_t level = file->rx_wake_level;
+
+    if (!_bsp_kernel_active)
+    {
+        return;
+    }
+
+    if (file->async_read_head != NULL && len > len_before)
+    {
+        sem_give(_g_ubidrv_uart_async_sem);
+    }
+
+    if ((file->poll_events & UBIDRV_UART_POLL_IN) && len > len_before)
+    {
+        sem_give(_g_ubidrv_uart_poll_sem);
+    }
+
+    if ((len_before < level && len >= level) || (idle && len > 0 && len < level))
+    {
+#if (UBIDRV_UART_STATS_ENABLE == 1)
+        if (file->stats_reader_waiting && !file->stats_signal_pending)
+        {
+            file->stats_signal_cycles = _ubidrv_uart_stats_cycles();
+            file->stats_signal_pending = 1;
+        }
+#endif
+        sem_give(file->read_sem);
+    }
+}
+
+void ubidrv_uart_rx_callback(int fd)
+{
+    uint16_t len;
+    uint32_t len_before;
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+    ubi_assert(file->init == 1);
+
+    UBIDRV_UART_STATS_INC(file, rx_isr_count);
+
+    do
+    {
+        if (file->hal_uart->ErrorCode != HAL_UART_ERROR_NONE)
+        {
+            break;
+        }
+
+        if (file->need_reset)
+        {
+            break;
+        }
+
+        if (file->need_rx_restart)
+        {
+            bsp_abortsystem();
+        }
+
+        if (file->rx_dma)
+        {
+            break;
+        }
+
+        len = 1;
+
+        if (file->rx_flow == UBIDRV_UART_RX_FLOW_XONXOFF && _ubidrv_uart_tx_flow_take(fd, file->rx_it_byte))
+        {
+            /* Flow control from the peer is not stored */
+        }
+        else if (_ubidrv_uart_ring_is_full(&file->read_ring))
+        {
+            file->rx_overflow_count++;
+        }
+        else
+        {
+            len_before = _ubidrv_uart_ring_get_len(&file->read_ring);
+
+            _ubidrv_uart_ring_write(&file->read_ring, &file->rx_it_byte, len);
+            UBIDRV_UART_STATS_ADD(file, rx_bytes, len);
+            UBIDRV_UART_STATS_MAX(file, read_buffer_high, len_before + len);
+
+            _ubidrv_uart_rx_signal(file, len_before, 0);
+            _ubidrv_uart_rx_flow_check(fd);
+        }
+
+        _ubidrv_uart_rx_start(fd);
+        if (file->need_rx_restart && _bsp_kernel_active)
+        {
+            /* Let a blocked reader re-arm reception */
+            sem_give(file->read_sem);
+            if (file->async_read_head != NULL)
+            {
+                sem_give(_g_ubidrv_uart_async_sem);
+            }
+        }
+    } while (0);
+}
+
+void ubidrv_uart_rx_event_callback(int fd, uint16_t size)
+{
+    uint16_t pos;
+    uint32_t len_before;
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+    ubi_assert(file->init == 1);
+
+    UBIDRV_UART_STATS_INC(file, rx_isr_count);
+
+    do
+    {
+        if (file->hal_uart->ErrorCode != HAL_UART_ERROR_NONE)
+        {
+            break;
+        }
+
+        if (file->need_reset)
+        {
+            break;
+        }
+
+        if (!file->rx_dma || size > file->rx_dma_size)
+        {
+            break;
+        }
+
+        /* The HAL reports the DMA write position: half of the buffer on half transfer,
+         * the whole buffer on transfer complete, and anything in between on IDLE line. */
+        pos = size;
+        if (pos == file->rx_dma_pos)
+        {
+            break;
+        }
+
+        len_before = _ubidrv_uart_ring_get_len(&file->read_ring);
+
+        if (pos > file->rx_dma_pos)
+        {
+            _ubidrv_uart_rx_dma_push(fd, &file->rx_dma_buf[file->rx_dma_pos], pos - file->rx_dma_pos);
+        }
+        else
+        {
+            _ubidrv_uart_rx_dma_push(fd, &file->rx_dma_buf[file->rx_dma_pos], file->rx_dma_size - file->rx_dma_pos);
+            _ubidrv_uart_rx_dma_push(fd, &file->rx_dma_buf[0], pos);
+        }
+
+        file->rx_dma_pos = (pos == file->rx_dma_size) ? 0 : pos;
+
+        UBIDRV_UART_STATS_MAX(file, read_buffer_high, _ubidrv_uart_ring_get_len(&file->read_ring));
+
+        /* An IDLE line ends a burst, even when it happens to stop at the half or full transfer position */
+        _ubidrv_uart_rx_signal(file, len_before, (HAL_UARTEx_GetRxEventType(file->hal_uart) == HAL_UART_RXEVENT_IDLE));
+        _ubidrv_uart_rx_flow_check(fd);
+    } while (0);
+}
+
+/* Wake a writer waiting for free space once the write buffer has drained down to its space level,
+ * and the asynchronous writer once half of it is free */
+static void _ubidrv_uart_tx_space_signal(ubidrv_uart_file_t * file)
+{
+    uint32_t level = file->tx_space_level;
+    uint32_t free_len = _ubidrv_uart_ring_get_free_len(&file->write_ring);
+
+    if (level > 0 && free_len >= level)
+    {
+        file->tx_space_level = 0;
+        if (_bsp_kernel_active)
+        {
+            sem_give(file->space_sem);
+        }
+    }
+
+    if (file->async_write_head != NULL && free_len >= _ubidrv_uart_ring_get_capacity(&file->write_ring) / 2)
+    {
+        if (_bsp_kernel_active)
+        {
+            sem_give(_g_ubidrv_uart_async_sem);
+        }
+    }
+
+    /* A poller only sleeps on a full write buffer, so any freed space is news */
+    if ((file->poll_events & UBIDRV_UART_POLL_OUT) && free_len > 0)
+    {
+        if (_bsp_kernel_active)
+        {
+            sem_give(_g_ubidrv_uart_poll_sem);
+        }
+    }
+}
+
+void ubidrv_uart_tx_callback(int fd)
+{
+    uint16_t len;
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+    ubi_assert(file->init == 1);
+
+    UBIDRV_UART_STATS_INC(file, tx_isr_count);
+
+    do
+    {
+        if (file->hal_uart->ErrorCode != HAL_UART_ERROR_NONE)
+        {
+            break;
+        }
+
+        if (file->need_reset)
+        {
+            break;
+        }
+
+        if (file->tx_flow_sending)
+        {
+            file->tx_flow_sending = 0;
+        }
+        else
+        {
+            len = file->tx_dma ? file->tx_dma_len : 1;
+
+            /* The write buffer only shrinks here, so its level peaks right before */
+            UBIDRV_UART_STATS_MAX(file, write_buffer_high, _ubidrv_uart_ring_get_len(&file->write_ring));
+            UBIDRV_UART_STATS_ADD(file, tx_bytes, len);
+
+            _ubidrv_uart_ring_read(&file->write_ring, NULL, len);
+            _ubidrv_uart_tx_space_signal(file);
+        }
+
+        if (_ubidrv_uart_ring_get_len(&file->write_ring) == 0 && file->tx_flow_char == 0)
+        {
+            if (_bsp_kernel_active)
+            {
+                sem_give(file->write_sem);
+            }
+            file->need_tx_restart = 1;
+            break;
+        }
+
+        _ubidrv_uart_tx_start(fd);
+        if (file->need_tx_restart && _bsp_kernel_active)
+        {
+            /* Let a blocked flush or write restart transmission */
+            sem_give(file->write_sem);
+            sem_give(file->space_sem);
+            if (file->async_write_head != NULL)
+            {
+                sem_give(_g_ubidrv_uart_async_sem);
+            }
+        }
+    } while (0);
+}
+
+void ubidrv_uart_err_callback(int fd)
+{
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+    ubi_assert(file->init == 1);
+
+    file->need_reset = 1;
+
+#if (UBIDRV_UART_STATS_ENABLE == 1)
+    uint32_t err = file->hal_uart->ErrorCode;
+
+    file->stats.err_isr_count++;
+    if (err & HAL_UART_ERROR_ORE)
+    {
+        file->stats.err_overrun_count++;
+    }
+    if (err & HAL_UART_ERROR_FE)
+    {
+        file->stats.err_framing_count++;
+    }
+    if (err & HAL_UART_ERROR_NE)
+    {
+        file->stats.err_noise_count++;
+    }
+    if (err & HAL_UART_ERROR_PE)
+    {
+        file->stats.err_parity_count++;
+    }
+    if (err & HAL_UART_ERROR_DMA)
+    {
+        file->stats.err_dma_count++;
+    }
+#endif
+
+    /* Wake up blocked readers and writers to reset the port right away */
+    if (_bsp_kernel_active)
+    {
+        sem_give(file->read_sem);
+        sem_give(file->write_sem);
+        sem_give(file->space_sem);
+        if (file->async_read_head != NULL || file->async_write_head != NULL)
+        {
+            sem_give(_g_ubidrv_uart_async_sem);
+        }
+        if (file->poll_events != 0)
+        {
+            sem_give(_g_ubidrv_uart_poll_sem);
+        }
+    }
+}
+
+
+void ubidrv_uart_ext_init(ubidrv_uart_ext_t * ext)
+{
+    ubi_assert(ext != NULL);
+
+    memset(ext, 0, sizeof(ubidrv_uart_ext_t));
+    ext->read_buffer_size = UBIDRV_UART_READ_BUFFER_SIZE;
+    ext->write_buffer_size = UBIDRV_UART_WRITE_BUFFER_SIZE;
+    ext->read_buffer = NULL;
+    ext->write_buffer = NULL;
+    ext->rx_mode = UBIDRV_UART_RX_MODE_IT;
+    ext->rx_dma_buffer_size = STM32CUBEF2__UBIDRV_UART_RX_DMA_BUFFER_SIZE;
+    ext->tx_mode = UBIDRV_UART_TX_MODE_IT;
+    ext->irq_priority = NVIC_PRIO_MIDDLE;
+    ext->rx_flow = UBIDRV_UART_RX_FLOW_NONE;
+    ext->rx_flow_high = 0;
+    ext->rx_flow_low = 0;
+    ext->rts_port = NULL;
+    ext->rts_pin = 0;
+    ext->hal_uart = NULL;
+}
+
+ubi_st_t ubidrv_uart_open(ubidrv_uart_t * uart)
+{
+    return ubidrv_uart_open_ext(uart, NULL);
+}
+
+ubi_st_t ubidrv_uart_open_ext(ubidrv_uart_t * uart, const ubidrv_uart_ext_t * ext)
+{
+    ubi_st_t ubi_err;
+    ubidrv_uart_file_t * file = NULL;
+    ubidrv_uart_ext_t ext_default;
+    int index;
+    uint32_t flow_high;
+    uint32_t flow_low;
+
+    ubi_assert(uart != NULL);
+
+    if (ext == NULL)
+    {
+        ubidrv_uart_ext_init(&ext_default);
+        ext = &ext_default;
+    }
+
+    do
+    {
+        if (ext->read_buffer_size == 0 || (ext->read_buffer_size & (ext->read_buffer_size - 1)) != 0 ||
+                ext->write_buffer_size == 0 || (ext->write_buffer_size & (ext->write_buffer_size - 1)) != 0)
+        {
+            ubi_err = UBI_ST_ERR_PARAM;
+            break;
+        }
 
-    do
-    {
-        for (int i = 0; i < UBIDRV_UART_FILE_NUM; i++)
+        _ubidrv_uart_rx_flow_marks(ext, &flow_high, &flow_low);
+        if (ext->rx_flow != UBIDRV_UART_RX_FLOW_NONE && (flow_low >= flow_high || flow_high > ext->read_buffer_size))
         {
-            if (0 == strncmp(_g_ubidrv_uart_file_names[i], uart->file_name, UBIDRV_UART_FILE_NAME_MAX))
-            {
-                file = &_g_ubidrv_uart_files[i];
-                file->hal_uart = &_g_ubidrv_uart_handle[i];
-                uart->fd = i + 1;
-                break;
-            }
+            ubi_err = UBI_ST_ERR_PARAM;
+            break;
+        }
+        if (ext->rx_flow == UBIDRV_UART_RX_FLOW_RTS && ext->rts_port == NULL)
+        {
+            ubi_err = UBI_ST_ERR_PARAM;
+            break;
         }
-        if (file == NULL)
+
+        index = _ubidrv_uart_get_file_index(uart->file_name);
+        if (index < 0 || _g_ubidrv_uart_file_instance[index] == NULL)
         {
             ubi_err = UBI_ST_ERR_NOT_FOUND;
             break;
         }
+        file = &_g_ubidrv_uart_files[index];
+        file->hal_uart = (ext->hal_uart != NULL) ? (UART_HandleTypeDef *) ext->hal_uart : &_g_ubidrv_uart_handle[index];
+        file->irq_priority = ext->irq_priority;
+        uart->fd = index + 1;
 
         file->hal_uart->Instance = _g_ubidrv_uart_file_instance[uart->fd - 1];
         file->hal_uart->Init.BaudRate = uart->baud_rate;
@@ -472,10 +1402,25 @@ ubi_st_t ubidrv_uart_open(ubidrv_uart_t * uart)
                 file->hal_uart->Init.HwFlowCtl = UART_HWCONTROL_NONE;
                 break;
         }
+        if (ext->rx_flow == UBIDRV_UART_RX_FLOW_RTS)
+        {
+            /* RTS is driven by the driver */
+            switch (file->hal_uart->Init.HwFlowCtl)
+            {
+                case UART_HWCONTROL_RTS_CTS:
+                    file->hal_uart->Init.HwFlowCtl = UART_HWCONTROL_CTS;
+                    break;
+                case UART_HWCONTROL_RTS:
+                    file->hal_uart->Init.HwFlowCtl = UART_HWCONTROL_NONE;
+                    break;
+                default:
+                    break;
+            }
+        }
         file->hal_uart->Init.Mode = UART_MODE_TX_RX;
         file->hal_uart->Init.OverSampling = UART_OVERSAMPLING_16;
 
-        ubi_err = _ubidrv_uart_init(uart->fd);
+        ubi_err = _ubidrv_uart_init(uart->fd, ext);
 
         break;
     } while (1);
@@ -504,14 +1449,17 @@ ubi_st_t ubidrv_uart_getc_timedms(int fd, char *ch_p, uint32_t timeoutms, uint32
 }
 
 ubi_st_t ubidrv_uart_putc(int fd, int ch)
+{
+    char data = (char) ch;
+
+    return _ubidrv_uart_putn_advan(fd, &data, 1);
+}
+
+ubi_st_t ubidrv_uart_flush(int fd)
 {
     ubi_st_t ubi_err;
-    uint8_t * buf;
-    uint16_t len;
-    uint32_t written;
-    uint8_t data[2];
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
 
@@ -537,52 +1485,31 @@ ubi_st_t ubidrv_uart_putc(int fd, int ch)
 
         mutex_lock(file->put_lock);
 
-        do
+        for (;;)
         {
             if (file->need_reset)
             {
                 _ubidrv_uart_reset(fd);
             }
 
-            if (0 != file->autocr && '\n' == ch)
-            {
-                data[0] = '\r';
-                data[1] = '\n';
-                len = 2;
-            }
-            else
-            {
-                data[0] = (uint8_t) ch;
-                len = 1;
-            }
-
-            if (cbuf_get_len(file->write_cbuf) == 0)
-            {
-                sem_clear(file->write_sem);
-                file->need_tx_restart = 1;
-            }
-
-            cbuf_write(file->write_cbuf, data, len, &written);
-            if (written == 0)
-            {
-                file->tx_overflow_count++;
-            }
-
-            if (file->need_tx_restart)
+            if (file->need_tx_restart && _ubidrv_uart_ring_get_len(&file->write_ring) > 0)
             {
-                len = 1;
-                buf = cbuf_get_head_addr(file->write_cbuf);
-                file->need_tx_restart = 0;
-                if (HAL_UART_Transmit_IT(file->hal_uart, buf, len) != HAL_OK)
+                _ubidrv_uart_tx_start(fd);
+                if (file->need_tx_restart)
                 {
-                    file->need_tx_restart = 1;
+                    ubi_err = UBI_ST_BUSY;
                     break;
                 }
             }
 
-            ubi_err = UBI_ST_OK;
-            break;
-        } while (1);
+            if (_ubidrv_uart_ring_get_len(&file->write_ring) == 0)
+            {
+                ubi_err = UBI_ST_OK;
+                break;
+            }
+
+            _ubidrv_uart_sem_take(file, file->write_sem);
+        }
 
         mutex_unlock(file->put_lock);
 
@@ -592,81 +1519,117 @@ ubi_st_t ubidrv_uart_putc(int fd, int ch)
     return ubi_err;
 }
 
-ubi_st_t ubidrv_uart_flush(int fd)
+static ubi_st_t _ubidrv_uart_put_polled(USART_TypeDef * usart, const uint8_t * data, uint32_t len)
 {
-    ubi_st_t ubi_err;
-    uint8_t * buf;
-    uint16_t len;
-
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
-    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
-    ubi_assert(file->init == 1);
+    uint32_t i;
+    uint32_t spin;
 
-    do
+    for (i = 0; i < len; i++)
     {
-        if (bsp_isintr() || 0 != _bsp_critcount)
+        for (spin = 0; (usart->SR & USART_SR_TXE) == 0; spin++)
         {
-            ubi_err = UBI_ST_ERR_INVALID_STATE;
-            break;
+            if (spin >= UBIDRV_UART_POLLED_SPIN_MAX)
+            {
+                return UBI_ST_ERR_IO;
+            }
         }
+        usart->DR = data[i];
+    }
 
-        if (!_bsp_kernel_active)
-        {
-            ubi_err = UBI_ST_ERR_INVALID_STATE;
-            break;
-        }
+    return UBI_ST_OK;
+}
 
-        if (!file->init)
+ubi_st_t ubidrv_uart_write_polled(int fd, const uint8_t * data, uint32_t len)
+{
+    ubi_st_t ubi_err;
+    USART_TypeDef * usart;
+    uint32_t spin;
+    uint32_t span_len;
+    uint8_t * span;
+    uint32_t sent;
+    uint32_t primask;
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+
+    do
+    {
+        if (!file->init || file->hal_uart == NULL)
         {
             ubi_err = UBI_ST_ERR_INIT;
             break;
         }
 
-        mutex_lock(file->put_lock);
+        usart = file->hal_uart->Instance;
 
-        for (;;)
+        if (!file->tx_polled)
         {
-            if (file->need_reset)
+            /* Stop the interrupt and dma transmit engines (the port is reset on its next normal use),
+             * and send what is left in the write buffer first so that it keeps its order with data */
+            primask = __get_PRIMASK();
+            __disable_irq();
+
+            CLEAR_BIT(usart->CR1, USART_CR1_TXEIE | USART_CR1_TCIE);
+            CLEAR_BIT(usart->CR3, USART_CR3_DMAT);
+            file->tx_polled = 1;
+            file->need_reset = 1;
+
+            /* Drop what the stopped transfer has already handed to the data register
+             * (its completion callback, which would have done it, now sees need_reset) */
+            if (file->hal_uart->gState == HAL_UART_STATE_BUSY_TX && !file->tx_flow_sending)
             {
-                _ubidrv_uart_reset(fd);
+                if (file->tx_dma)
+                {
+                    sent = file->tx_dma_len - __HAL_DMA_GET_COUNTER(file->hal_uart->hdmatx);
+                }
+                else
+                {
+                    sent = (file->hal_uart->TxXferCount == 0) ? 1 : 0;
+                }
+                UBIDRV_UART_STATS_ADD(file, tx_bytes, sent);
+                _ubidrv_uart_ring_read(&file->write_ring, NULL, sent);
             }
 
-            if (file->need_tx_restart && cbuf_get_len(file->write_cbuf) > 0)
+            __set_PRIMASK(primask);
+
+            while (_ubidrv_uart_ring_get_len(&file->write_ring) > 0)
             {
-                len = 1;
-                buf = cbuf_get_head_addr(file->write_cbuf);
-                file->need_tx_restart = 0;
-                if (HAL_UART_Transmit_IT(file->hal_uart, buf, len) != HAL_OK)
+                span = _ubidrv_uart_ring_get_span(&file->write_ring, 0, _ubidrv_uart_ring_get_len(&file->write_ring), &span_len);
+                if (_ubidrv_uart_put_polled(usart, span, span_len) != UBI_ST_OK)
                 {
-                    file->need_tx_restart = 1;
-                    ubi_err = UBI_ST_BUSY;
                     break;
                 }
+                _ubidrv_uart_ring_read(&file->write_ring, NULL, span_len);
             }
+        }
+
+        ubi_err = _ubidrv_uart_put_polled(usart, data, len);
+        if (ubi_err != UBI_ST_OK)
+        {
+            break;
+        }
 
-            if (cbuf_get_len(file->write_cbuf) == 0)
+        for (spin = 0; (usart->SR & USART_SR_TC) == 0; spin++)
+        {
+            if (spin >= UBIDRV_UART_POLLED_SPIN_MAX)
             {
-                ubi_err = UBI_ST_OK;
+                ubi_err = UBI_ST_ERR_IO;
                 break;
             }
-
-            sem_take_timedms(file->write_sem, UBIDRV_UART_CHECK_INTERVAL_MS);
         }
 
-        mutex_unlock(file->put_lock);
-
         break;
     } while (1);
 
     return ubi_err;
 }
 
-
 int ubidrv_uart_putn(int fd, const char *str, int len)
 {
     int r;
+    ubi_st_t ubi_err;
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
 
@@ -700,23 +1663,160 @@ int ubidrv_uart_putn(int fd, const char *str, int len)
             break;
         }
 
-        for (r = 0; r < len; r++)
+        ubi_err = _ubidrv_uart_putn_advan(fd, str, len);
+        if (ubi_err != UBI_ST_OK && ubi_err != UBI_ST_BUSY)
         {
-            ubidrv_uart_putc(fd, *str);
-            str++;
+            break;
         }
 
+        r = len;
+
         break;
     } while (1);
 
     return r;
 }
 
+static uint32_t _ubidrv_uart_poll_check(ubidrv_uart_pollfd_t * fds, uint32_t nfds)
+{
+    uint32_t count = 0;
+    ubidrv_uart_file_t * file;
+
+    for (uint32_t i = 0; i < nfds; i++)
+    {
+        file = &_g_ubidrv_uart_files[fds[i].fd - 1];
+
+        fds[i].revents = 0;
+        if ((fds[i].events & UBIDRV_UART_POLL_IN) && _ubidrv_uart_ring_get_len(&file->read_ring) > 0)
+        {
+            fds[i].revents |= UBIDRV_UART_POLL_IN;
+        }
+        if ((fds[i].events & UBIDRV_UART_POLL_OUT) && _ubidrv_uart_ring_get_free_len(&file->write_ring) > 0)
+        {
+            fds[i].revents |= UBIDRV_UART_POLL_OUT;
+        }
+        if (file->need_reset)
+        {
+            fds[i].revents |= UBIDRV_UART_POLL_ERR;
+        }
+
+        if (fds[i].revents != 0)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static ubi_st_t _ubidrv_uart_poll_advan(ubidrv_uart_pollfd_t * fds, uint32_t nfds, uint32_t * nready, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    int r;
+    ubi_st_t ubi_err;
+    uint32_t count = 0;
+    uint32_t i;
+
+    ubi_assert(fds != NULL || nfds == 0);
+
+    do
+    {
+        if (bsp_isintr() || 0 != _bsp_critcount)
+        {
+            ubi_err = UBI_ST_ERR_INVALID_STATE;
+            break;
+        }
+
+        if (!_bsp_kernel_active)
+        {
+            ubi_err = UBI_ST_ERR_INVALID_STATE;
+            break;
+        }
+
+        for (i = 0; i < nfds; i++)
+        {
+            if (fds[i].fd <= 0 || fds[i].fd > UBIDRV_UART_FILE_SLOT_NUM || !_g_ubidrv_uart_files[fds[i].fd - 1].init)
+            {
+                break;
+            }
+        }
+        if (i < nfds || _g_ubidrv_uart_poll_sem == NULL)
+        {
+            ubi_err = UBI_ST_ERR_PARAM;
+            break;
+        }
+
+        ubik_entercrit();
+        r = _g_ubidrv_uart_poll_busy;
+        _g_ubidrv_uart_poll_busy = 1;
+        ubik_exitcrit();
+        if (r)
+        {
+            ubi_err = UBI_ST_BUSY;
+            break;
+        }
+
+        /* Interest is published before the first check, so an event right after a check still gives the semaphore */
+        sem_clear(_g_ubidrv_uart_poll_sem);
+        for (i = 0; i < nfds; i++)
+        {
+            _g_ubidrv_uart_files[fds[i].fd - 1].poll_events |= fds[i].events;
+        }
+
+        for (;;)
+        {
+            count = _ubidrv_uart_poll_check(fds, nfds);
+            if (count > 0)
+            {
+                ubi_err = UBI_ST_OK;
+                break;
+            }
+
+            if (io_option == UBIDEV_UART_IO_OPTION__TIMED)
+            {
+                if (timeoutms == 0)
+                {
+                    ubi_err = UBI_ST_TIMEOUT;
+                    break;
+                }
+                sem_take_timedms(_g_ubidrv_uart_poll_sem, timeoutms);
+                timeoutms = task_getremainingtimeoutms();
+            }
+            else
+            {
+#if (UBIDRV_UART_CHECK_INTERVAL_MS > 0)
+                sem_take_timedms(_g_ubidrv_uart_poll_sem, UBIDRV_UART_CHECK_INTERVAL_MS);
+#else
+                sem_take(_g_ubidrv_uart_poll_sem);
+#endif
+            }
+        }
+
+        for (i = 0; i < nfds; i++)
+        {
+            _g_ubidrv_uart_files[fds[i].fd - 1].poll_events = 0;
+        }
+
+        _g_ubidrv_uart_poll_busy = 0;
+    } while (0);
+
+    if (nready != NULL)
+    {
+        *nready = count;
+    }
+
+    if (io_option == UBIDEV_UART_IO_OPTION__TIMED && remain_timeoutms != NULL)
+    {
+        *remain_timeoutms = timeoutms;
+    }
+
+    return ubi_err;
+}
+
 int ubidrv_uart_kbhit(int fd)
 {
     int r;
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
 
@@ -738,7 +1838,7 @@ int ubidrv_uart_kbhit(int fd)
             break;
         }
 
-        if (cbuf_get_len(file->read_cbuf) != 0)
+        if (_ubidrv_uart_ring_get_len(&file->read_ring) != 0)
         {
             r = 1;
         }
@@ -755,7 +1855,8 @@ int ubidrv_uart_kbhit(int fd)
 
 int ubidrv_uart_puts(int fd, const char *str, int max)
 {
-    int i;
+    int len;
+    const char * nul;
     ubi_st_t ubi_err;
 
     if (NULL == str)
@@ -768,29 +1869,23 @@ int ubidrv_uart_puts(int fd, const char *str, int max)
         return -3;
     }
 
-    for (i = 0; i < max; i++)
+    nul = memchr(str, '\0', max);
+    len = (nul != NULL) ? (nul - str) : max;
+
+    ubi_err = _ubidrv_uart_putn_advan(fd, str, len);
+    if (ubi_err != UBI_ST_OK && ubi_err != UBI_ST_BUSY)
     {
-        if ('\0' == *str)
-        {
-            break;
-        }
-        ubi_err = ubidrv_uart_putc(fd, *str);
-        if (ubi_err != UBI_ST_OK)
-        {
-            break;
-        }
-        str++;
+        return 0;
     }
 
-    return i;
+    return len;
 }
 
 int ubidrv_uart_gets(int fd, char *str, int max)
 {
-    int i;
-    ubi_st_t ubi_err;
+    uint32_t len = 0;
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
 
@@ -804,26 +1899,29 @@ int ubidrv_uart_gets(int fd, char *str, int max)
         return -3;
     }
 
-    for (i = 0; i < max; i++)
-    {
-        ubi_err = ubidrv_uart_getc(fd, &str[i]);
-        if (UBI_ST_OK != ubi_err || '\0' == str[i] || '\n' == str[i] || '\r' == str[i])
-        {
-            break;
-        }
-    }
-    if (0 != i && max == i)
+    if (0 == max)
     {
-        i--;
+        return 0;
     }
-    str[i] = '\0';
 
-    return i;
+    _ubidrv_uart_getline_advan(fd, str, max, UBIDRV_UART_LINE_TERM_ANY, &len, UBIDEV_UART_IO_OPTION__BLOCKED, 0, NULL);
+
+    return len;
+}
+
+ubi_st_t ubidrv_uart_getline(int fd, char *str, uint32_t max, ubidrv_uart_line_term_t term, uint32_t *len)
+{
+    return _ubidrv_uart_getline_advan(fd, str, max, term, len, UBIDEV_UART_IO_OPTION__BLOCKED, 0, NULL);
+}
+
+ubi_st_t ubidrv_uart_getline_timedms(int fd, char *str, uint32_t max, ubidrv_uart_line_term_t term, uint32_t *len, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    return _ubidrv_uart_getline_advan(fd, str, max, term, len, UBIDEV_UART_IO_OPTION__TIMED, timeoutms, remain_timeoutms);
 }
 
 ubi_st_t ubidrv_uart_setecho(int fd, int echo)
 {
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
 
@@ -834,7 +1932,7 @@ ubi_st_t ubidrv_uart_setecho(int fd, int echo)
 
 int ubidrv_uart_getecho(int fd)
 {
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
 
@@ -843,7 +1941,7 @@ int ubidrv_uart_getecho(int fd)
 
 ubi_st_t ubidrv_uart_setautocr(int fd, int autocr)
 {
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
 
@@ -854,13 +1952,84 @@ ubi_st_t ubidrv_uart_setautocr(int fd, int autocr)
 
 int ubidrv_uart_getautocr(int fd)
 {
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(file->init == 1);
 
     return file->autocr;
 }
 
+ubi_st_t ubidrv_uart_setrxwake(int fd, uint32_t threshold, uint32_t timeoutms)
+{
+    ubi_st_t ubi_err;
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+    ubi_assert(file->init == 1);
+
+    do
+    {
+        if (threshold == 0 || threshold > _ubidrv_uart_ring_get_capacity(&file->read_ring))
+        {
+            ubi_err = UBI_ST_ERR_PARAM;
+            break;
+        }
+
+        file->rx_wake_threshold = threshold;
+        file->rx_wake_timeoutms = timeoutms;
+
+        ubi_err = UBI_ST_OK;
+        break;
+    } while (1);
+
+    return ubi_err;
+}
+
+ubi_st_t ubidrv_uart_poll(ubidrv_uart_pollfd_t * fds, uint32_t nfds, uint32_t * nready)
+{
+    return _ubidrv_uart_poll_advan(fds, nfds, nready, UBIDEV_UART_IO_OPTION__BLOCKED, 0, NULL);
+}
+
+ubi_st_t ubidrv_uart_poll_timedms(ubidrv_uart_pollfd_t * fds, uint32_t nfds, uint32_t * nready, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    return _ubidrv_uart_poll_advan(fds, nfds, nready, UBIDEV_UART_IO_OPTION__TIMED, timeoutms, remain_timeoutms);
+}
+
+ubi_st_t ubidrv_uart_get_stats(int fd, ubidrv_uart_stats_t * stats, int reset)
+{
+#if (UBIDRV_UART_STATS_ENABLE == 1)
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * file = &_g_ubidrv_uart_files[fd - 1];
+    ubi_assert(file->init == 1);
+    ubi_assert(stats != NULL);
+
+    ubik_entercrit();
+
+    *stats = file->stats;
+    stats->rx_overflow_count = file->rx_overflow_count;
+    stats->tx_overflow_count = file->tx_overflow_count;
+    stats->reset_count = file->reset_count;
+
+    if (reset)
+    {
+        memset(&file->stats, 0, sizeof(file->stats));
+        file->rx_overflow_count = 0;
+        file->tx_overflow_count = 0;
+        file->reset_count = 0;
+    }
+
+    ubik_exitcrit();
+
+    return UBI_ST_OK;
+#else
+    (void) fd;
+    (void) stats;
+    (void) reset;
+
+    return UBI_ST_ERR_NOT_SUPPORTED;
+#endif
+}
+
 #endif /* (UBINOS__BSP__BOARD_MODEL == UBINOS__BSP__BOARD_MODEL__NUCLEOF207ZG) */
 #endif /* (UBINOS__UBIDRV__INCLUDE_UART == 1) */
 
@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2022 Sung Ho Park and CSOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <ubinos.h>
+
+#if (UBINOS__UBIDRV__INCLUDE_UART_IO == 1)
+#if (UBINOS__BSP__BOARD_MODEL == UBINOS__BSP__BOARD_MODEL__NUCLEOF207ZG)
+
+#if (INCLUDE__UBINOS__UBIK != 1)
+    #error "ubik is necessary"
+#endif
+
+#include <ubinos/ubidrv/uart.h>
+#include <ubinos/ubidrv/uart_io.h>
+#include <ubinos/bsp/arch.h>
+
+#include <stm32cubef2_extension/ubidrv/uart.h>
+#include <stm32cubef2_extension/ubidrv/uart_io.h>
+
+#include <assert.h>
+#include <string.h>
+
+#include "main.h"
+
+#include "_uart_ring.h"
+#include "_uart.h"
+
+/*
+ * Requests are kept in a FIFO per port and direction. Submitters append and cancel under a critical section;
+ * the isr callbacks only look at the queue heads to decide whether to give _g_ubidrv_uart_async_sem.
+ * ubidrv_uart_io_async_process moves data with get_lock or put_lock held, so a request is never touched
+ * by the driver while ubidrv_uart_io_async_cancel (which takes the same lock) removes it.
+ */
+
+static ubi_st_t _ubidrv_uart_io_async_submit(ubidrv_uart_io_async_t * async, int write);
+static ubidrv_uart_io_async_t * _ubidrv_uart_io_async_pop(ubidrv_uart_io_async_t * volatile * head, ubidrv_uart_io_async_t ** tail);
+static int _ubidrv_uart_io_async_remove(ubidrv_uart_io_async_t * volatile * head, ubidrv_uart_io_async_t ** tail, ubidrv_uart_io_async_t * async);
+static void _ubidrv_uart_io_async_read_process(int fd, ubidrv_uart_io_async_t ** done_head, ubidrv_uart_io_async_t ** done_tail);
+static void _ubidrv_uart_io_async_write_process(int fd, ubidrv_uart_io_async_t ** done_head, ubidrv_uart_io_async_t ** done_tail);
+static void _ubidrv_uart_io_async_done(ubidrv_uart_io_async_t * async, ubi_st_t status, ubidrv_uart_io_async_t ** done_head, ubidrv_uart_io_async_t ** done_tail);
+
+static ubi_st_t _ubidrv_uart_io_async_submit(ubidrv_uart_io_async_t * async, int write)
+{
+    ubi_st_t ubi_err;
+    ubidrv_uart_file_t * uart_file;
+
+    ubi_assert(async != NULL);
+    ubi_assert(0 < async->fd && async->fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    uart_file = &_g_ubidrv_uart_files[async->fd - 1];
+    ubi_assert(uart_file->init == 1);
+
+    do
+    {
+        if (async->buf == NULL && async->len > 0)
+        {
+            ubi_err = UBI_ST_ERR_PARAM;
+            break;
+        }
+
+        async->write = write;
+        async->done = 0;
+        async->status = UBI_ST_BUSY;
+        async->next = NULL;
+
+        ubik_entercrit();
+
+        if (write)
+        {
+            if (uart_file->async_write_head == NULL)
+            {
+                uart_file->async_write_head = async;
+            }
+            else
+            {
+                uart_file->async_write_tail->next = async;
+            }
+            uart_file->async_write_tail = async;
+        }
+        else
+        {
+            if (uart_file->async_read_head == NULL)
+            {
+                uart_file->async_read_head = async;
+            }
+            else
+            {
+                uart_file->async_read_tail->next = async;
+            }
+            uart_file->async_read_tail = async;
+        }
+
+        ubik_exitcrit();
+
+        /* Data may already be waiting, or the write buffer may have room */
+        sem_give(_g_ubidrv_uart_async_sem);
+
+        ubi_err = UBI_ST_OK;
+    } while (0);
+
+    return ubi_err;
+}
+
+static ubidrv_uart_io_async_t * _ubidrv_uart_io_async_pop(ubidrv_uart_io_async_t * volatile * head, ubidrv_uart_io_async_t ** tail)
+{
+    ubidrv_uart_io_async_t * async;
+
+    ubik_entercrit();
+
+    async = *head;
+    if (async != NULL)
+    {
+        *head = async->next;
+        if (*head == NULL)
+        {
+            *tail = NULL;
+        }
+        async->next = NULL;
+    }
+
+    ubik_exitcrit();
+
+    return async;
+}
+
+static int _ubidrv_uart_io_async_remove(ubidrv_uart_io_async_t * volatile * head, ubidrv_uart_io_async_t ** tail, ubidrv_uart_io_async_t * async)
+{
+    ubidrv_uart_io_async_t * prev = NULL;
+    ubidrv_uart_io_async_t * cur;
+    int found = 0;
+
+    ubik_entercrit();
+
+    for (cur = *head; cur != NULL; prev = cur, cur = cur->next)
+    {
+        if (cur == async)
+        {
+            if (prev == NULL)
+            {
+                *head = cur->next;
+            }
+            else
+            {
+                prev->next = cur->next;
+            }
+            if (*tail == cur)
+            {
+                *tail = prev;
+            }
+            cur->next = NULL;
+            found = 1;
+            break;
+        }
+    }
+
+    ubik_exitcrit();
+
+    return found;
+}
+
+static void _ubidrv_uart_io_async_done(ubidrv_uart_io_async_t * async, ubi_st_t status, ubidrv_uart_io_async_t ** done_head, ubidrv_uart_io_async_t ** done_tail)
+{
+    async->status = status;
+    async->next = NULL;
+
+    if (*done_head == NULL)
+    {
+        *done_head = async;
+    }
+    else
+    {
+        (*done_tail)->next = async;
+    }
+    *done_tail = async;
+}
+
+static void _ubidrv_uart_io_async_read_process(int fd, ubidrv_uart_io_async_t ** done_head, ubidrv_uart_io_async_t ** done_tail)
+{
+    int r;
+    ubidrv_uart_io_async_t * async;
+    uint32_t wanted;
+    ubidrv_uart_file_t * uart_file = &_g_ubidrv_uart_files[fd - 1];
+
+    if (uart_file->async_read_head == NULL)
+    {
+        return;
+    }
+
+    /* A blocked synchronous reader owns the port for now; its next wake-up gives another chance */
+    r = mutex_lock_timedms(uart_file->get_lock, 0);
+    if (r != 0)
+    {
+        return;
+    }
+
+    if (uart_file->need_rx_restart)
+    {
+        _ubidrv_uart_rx_start(fd);
+    }
+
+    while ((async = uart_file->async_read_head) != NULL)
+    {
+        async->done += _ubidrv_uart_ring_read(&uart_file->read_ring, &async->buf[async->done], async->len - async->done);
+        _ubidrv_uart_rx_flow_resume(fd);
+
+        /* Complete like a blocking read would return: once full, or once the rx wake threshold is reached */
+        wanted = min(async->len, uart_file->rx_wake_threshold);
+        if (async->done < wanted)
+        {
+            break;
+        }
+
+        _ubidrv_uart_io_async_pop(&uart_file->async_read_head, &uart_file->async_read_tail);
+        _ubidrv_uart_io_async_done(async, UBI_ST_OK, done_head, done_tail);
+    }
+
+    r = mutex_unlock(uart_file->get_lock);
+    assert(r == 0);
+}
+
+static void _ubidrv_uart_io_async_write_process(int fd, ubidrv_uart_io_async_t ** done_head, ubidrv_uart_io_async_t ** done_tail)
+{
+    int r;
+    ubidrv_uart_io_async_t * async;
+    uint32_t n;
+    ubi_st_t status;
+    ubidrv_uart_file_t * uart_file = &_g_ubidrv_uart_files[fd - 1];
+
+    if (uart_file->async_write_head == NULL)
+    {
+        return;
+    }
+
+    r = mutex_lock_timedms(uart_file->put_lock, 0);
+    if (r != 0)
+    {
+        return;
+    }
+
+    while ((async = uart_file->async_write_head) != NULL)
+    {
+        if (_ubidrv_uart_tx_is_idle(uart_file))
+        {
+            sem_clear(uart_file->write_sem);
+            uart_file->need_tx_restart = 1;
+        }
+
+        n = _ubidrv_uart_ring_write(&uart_file->write_ring, &async->buf[async->done], async->len - async->done);
+        async->done += n;
+
+        status = UBI_ST_OK;
+        if (uart_file->need_tx_restart && _ubidrv_uart_ring_get_len(&uart_file->write_ring) > 0)
+        {
+            _ubidrv_uart_tx_start(fd);
+            if (uart_file->need_tx_restart)
+            {
+                status = UBI_ST_ERR_IO;
+            }
+        }
+
+        /* A write completes once all of it is queued, not when it is on the wire (see ubidrv_uart_io_flush) */
+        if (status == UBI_ST_OK && async->done < async->len)
+        {
+            break;
+        }
+
+        _ubidrv_uart_io_async_pop(&uart_file->async_write_head, &uart_file->async_write_tail);
+        _ubidrv_uart_io_async_done(async, status, done_head, done_tail);
+
+        if (status != UBI_ST_OK)
+        {
+            break;
+        }
+    }
+
+    r = mutex_unlock(uart_file->put_lock);
+    assert(r == 0);
+}
+
+ubi_st_t ubidrv_uart_io_read_async(ubidrv_uart_io_async_t * async)
+{
+    return _ubidrv_uart_io_async_submit(async, 0);
+}
+
+ubi_st_t ubidrv_uart_io_write_async(ubidrv_uart_io_async_t * async)
+{
+    return _ubidrv_uart_io_async_submit(async, 1);
+}
+
+ubi_st_t ubidrv_uart_io_async_cancel(ubidrv_uart_io_async_t * async)
+{
+    ubi_st_t ubi_err;
+    int r;
+    int found;
+    ubidrv_uart_file_t * uart_file;
+
+    ubi_assert(async != NULL);
+    ubi_assert(0 < async->fd && async->fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    uart_file = &_g_ubidrv_uart_files[async->fd - 1];
+    ubi_assert(uart_file->init == 1);
+
+    if (async->write)
+    {
+        r = mutex_lock(uart_file->put_lock);
+        assert(r == 0);
+        found = _ubidrv_uart_io_async_remove(&uart_file->async_write_head, &uart_file->async_write_tail, async);
+        r = mutex_unlock(uart_file->put_lock);
+        assert(r == 0);
+    }
+    else
+    {
+        r = mutex_lock(uart_file->get_lock);
+        assert(r == 0);
+        found = _ubidrv_uart_io_async_remove(&uart_file->async_read_head, &uart_file->async_read_tail, async);
+        r = mutex_unlock(uart_file->get_lock);
+        assert(r == 0);
+    }
+
+    if (found)
+    {
+        /* done tells how much was transferred before the cancel */
+        async->status = UBI_ST_TIMEOUT;
+        ubi_err = UBI_ST_OK;
+    }
+    else
+    {
+        ubi_err = UBI_ST_ERR_NOT_FOUND;
+    }
+
+    return ubi_err;
+}
+
+int ubidrv_uart_io_async_process(void)
+{
+    ubidrv_uart_io_async_t * done_head = NULL;
+    ubidrv_uart_io_async_t * done_tail = NULL;
+    ubidrv_uart_io_async_t * async;
+    ubidrv_uart_file_t * uart_file;
+    int count = 0;
+
+    for (int fd = 1; fd <= UBIDRV_UART_FILE_SLOT_NUM; fd++)
+    {
+        uart_file = &_g_ubidrv_uart_files[fd - 1];
+        if (!uart_file->init)
+        {
+            continue;
+        }
+
+        if (uart_file->async_read_head == NULL && uart_file->async_write_head == NULL)
+        {
+            continue;
+        }
+
+        if (uart_file->need_reset)
+        {
+            _ubidrv_uart_reset(fd);
+        }
+
+        _ubidrv_uart_io_async_read_process(fd, &done_head, &done_tail);
+        _ubidrv_uart_io_async_write_process(fd, &done_head, &done_tail);
+    }
+
+    /* Completions are delivered with no driver lock held, so callbacks can submit the next request */
+    while (done_head != NULL)
+    {
+        async = done_head;
+        done_head = async->next;
+        async->next = NULL;
+
+        if (async->callback != NULL)
+        {
+            async->callback(async);
+        }
+        if (async->sem != NULL)
+        {
+            sem_give(async->sem);
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+ubi_st_t ubidrv_uart_io_async_wait_timedms(uint32_t timeoutms)
+{
+    int r;
+
+    if (_g_ubidrv_uart_async_sem == NULL)
+    {
+        return UBI_ST_ERR_INIT;
+    }
+
+    r = sem_take_timedms(_g_ubidrv_uart_async_sem, timeoutms);
+    if (r == UBIK_ERR__TIMEOUT)
+    {
+        return UBI_ST_TIMEOUT;
+    }
+
+    return UBI_ST_OK;
+}
+
+#endif /* (UBINOS__BSP__BOARD_MODEL == UBINOS__BSP__BOARD_MODEL__NUCLEOF207ZG) */
+#endif /* (UBINOS__UBIDRV__INCLUDE_UART_IO == 1) */
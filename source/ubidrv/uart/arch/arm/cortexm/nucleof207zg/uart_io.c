@@ -17,35 +17,53 @@
 #include <ubinos/ubidrv/uart_io.h>
 #include <ubinos/bsp/arch.h>
 
+#include <stm32cubef2_extension/ubidrv/uart.h>
+#include <stm32cubef2_extension/ubidrv/uart_io.h>
+
 #include <assert.h>
 #include <string.h>
 
 #include "main.h"
 
+#include "_uart_ring.h"
 #include "_uart.h"
 
 #define UBIDRV_UART_IO_OPTION__TIMED 0x0001
 
-static ubi_st_t ubidrv_uart_io_read_advan(int fd, uint8_t *buffer, uint32_t length, uint32_t *read, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static ubi_st_t ubidrv_uart_io_readv_advan(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *read, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
 static ubi_st_t ubidrv_uart_io_write_advan(int fd, uint8_t *buffer, uint32_t length, uint32_t *written, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static ubi_st_t ubidrv_uart_io_writev_advan(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *written, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static ubi_st_t ubidrv_uart_io_tx_kick(int fd, ubidrv_uart_file_t * uart_file);
 static ubi_st_t ubidrv_uart_io_read_buf_clear_advan(int fd, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
 static ubi_st_t ubidrv_uart_io_flush_advan(int fd, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static ubi_st_t ubidrv_uart_io_read_acquire_advan(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
+static ubi_st_t ubidrv_uart_io_write_reserve_advan(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms);
 
-static ubi_st_t ubidrv_uart_io_read_advan(int fd, uint8_t *buffer, uint32_t length, uint32_t *read, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms)
+static ubi_st_t ubidrv_uart_io_readv_advan(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *read, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     ubi_st_t ubi_err;
     int r;
-    uint8_t * buf;
     uint32_t read_tmp;
-    uint32_t read_tmp2;
-    assert(buffer != NULL);
+    uint32_t length;
+    uint32_t vi;
+    uint32_t voff;
+    uint32_t n;
+    uint32_t gapms;
+    assert(vec != NULL || count == 0);
     (void) r;
     (void) ubi_err;
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * uart_file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(uart_file->init == 1);
 
+    length = 0;
+    for (vi = 0; vi < count; vi++)
+    {
+        assert(vec[vi].buf != NULL || vec[vi].len == 0);
+        length += vec[vi].len;
+    }
+
     do
     {
         if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
@@ -66,23 +84,33 @@ static ubi_st_t ubidrv_uart_io_read_advan(int fd, uint8_t *buffer, uint32_t leng
         }
 
         read_tmp = 0;
-        read_tmp2 = 0;
+        vi = 0;
+        voff = 0;
 
         for (;;)
         {
+            if (uart_file->need_reset)
+            {
+                _ubidrv_uart_reset(fd);
+            }
+
             if (uart_file->need_rx_restart)
             {
-                buf = cbuf_get_tail_addr(uart_file->read_cbuf);
-                uart_file->need_rx_restart = 0;
-                if (HAL_UART_Receive_IT(uart_file->hal_uart, buf, 1) != HAL_OK)
+                _ubidrv_uart_rx_start(fd);
+            }
+
+            /* Fill the regions in order, moving to the next one only when the current one is full */
+            for (; vi < count; vi++, voff = 0)
+            {
+                n = _ubidrv_uart_ring_read(&uart_file->read_ring, &vec[vi].buf[voff], vec[vi].len - voff);
+                read_tmp += n;
+                voff += n;
+                if (voff < vec[vi].len)
                 {
-                    uart_file->need_rx_restart = 1;
+                    break;
                 }
             }
-
-            ubi_err = cbuf_read(uart_file->read_cbuf, &buffer[read_tmp], length - read_tmp, &read_tmp2);
-            assert(ubi_err == UBI_ST_OK || ubi_err == UBI_ST_ERR_BUF_EMPTY);
-            read_tmp += read_tmp2;
+            _ubidrv_uart_rx_flow_resume(fd);
 
             if (read_tmp >= length)
             {
@@ -91,6 +119,15 @@ static ubi_st_t ubidrv_uart_io_read_advan(int fd, uint8_t *buffer, uint32_t leng
             }
             else
             {
+                _ubidrv_uart_set_rx_wake_level(uart_file, length - read_tmp);
+                if (_ubidrv_uart_ring_get_len(&uart_file->read_ring) >= uart_file->rx_wake_level)
+                {
+                    continue;
+                }
+
+                /* The inter-byte timeout starts with the first received byte */
+                gapms = (read_tmp > 0) ? uart_file->rx_wake_timeoutms : 0;
+
                 if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
                 {
                     if (timeoutms == 0)
@@ -98,23 +135,40 @@ static ubi_st_t ubidrv_uart_io_read_advan(int fd, uint8_t *buffer, uint32_t leng
                         ubi_err = UBI_ST_TIMEOUT;
                         break;
                     }
-                    r = sem_take_timedms(uart_file->read_sem, timeoutms);
+                    r = _ubidrv_uart_sem_take_timedms(uart_file, uart_file->read_sem, (gapms > 0) ? min(timeoutms, gapms) : timeoutms);
                     timeoutms = task_getremainingtimeoutms();
                     if (r == UBIK_ERR__TIMEOUT)
                     {
-                        ubi_err = UBI_ST_TIMEOUT;
+                        if (gapms > 0 && _ubidrv_uart_ring_get_len(&uart_file->read_ring) == 0)
+                        {
+                            ubi_err = UBI_ST_OK;
+                            break;
+                        }
+                        if (timeoutms == 0)
+                        {
+                            ubi_err = UBI_ST_TIMEOUT;
+                            break;
+                        }
+                    }
+                }
+                else if (gapms > 0)
+                {
+                    r = _ubidrv_uart_sem_take_timedms(uart_file, uart_file->read_sem, gapms);
+                    if (r == UBIK_ERR__TIMEOUT && _ubidrv_uart_ring_get_len(&uart_file->read_ring) == 0)
+                    {
+                        ubi_err = UBI_ST_OK;
                         break;
                     }
-                    assert(r == 0);
                 }
                 else
                 {
-                    r = sem_take(uart_file->read_sem);
-                    assert(r == 0);
+                    _ubidrv_uart_sem_take(uart_file, uart_file->read_sem);
                 }
             }
         }
 
+        uart_file->rx_wake_level = 1;
+
         if (read)
         {
             *read = read_tmp;
@@ -139,11 +193,11 @@ static ubi_st_t ubidrv_uart_io_write_advan(int fd, uint8_t *buffer, uint32_t len
 {
     ubi_st_t ubi_err;
     int r;
-    uint8_t *buf;
     uint32_t written_tmp;
+    uint32_t n;
     assert(buffer != NULL);
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * uart_file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(uart_file->init == 1);
 
@@ -172,47 +226,205 @@ static ubi_st_t ubidrv_uart_io_write_advan(int fd, uint8_t *buffer, uint32_t len
             assert(r == 0);
         }
 
-        if (cbuf_get_len(uart_file->write_cbuf) == 0)
+        written_tmp = 0;
+
+        /* Untimed writes queue what fits and return. Timed writes wait for the transmitter to drain
+         * until all of buffer is queued or the timeout expires. */
+        for (;;)
         {
-            sem_clear(uart_file->write_sem);
-            uart_file->need_tx_restart = 1;
+            if (uart_file->need_reset)
+            {
+                _ubidrv_uart_reset(fd);
+            }
+
+            if (_ubidrv_uart_tx_is_idle(uart_file))
+            {
+                sem_clear(uart_file->write_sem);
+                uart_file->need_tx_restart = 1;
+            }
+
+            n = _ubidrv_uart_ring_write(&uart_file->write_ring, &buffer[written_tmp], length - written_tmp);
+            written_tmp += n;
+
+            if (n > 0 || uart_file->need_tx_restart)
+            {
+                if (ubidrv_uart_io_tx_kick(fd, uart_file) != UBI_ST_OK)
+                {
+                    ubi_err = UBI_ST_ERR_IO;
+                    break;
+                }
+            }
+
+            if (written_tmp >= length)
+            {
+                ubi_err = UBI_ST_OK;
+                break;
+            }
+
+            if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) == 0)
+            {
+                if (written_tmp == 0)
+                {
+                    uart_file->tx_overflow_count++;
+                }
+                ubi_err = UBI_ST_ERR_BUF_FULL;
+                break;
+            }
+
+            if (timeoutms == 0)
+            {
+                ubi_err = UBI_ST_TIMEOUT;
+                break;
+            }
+
+            /* Wake up on the rest, or on half of the write buffer if the rest is bigger, so that
+             * a long write refills it in a few large chunks rather than byte by byte */
+            sem_clear(uart_file->space_sem);
+            uart_file->tx_space_level = min(length - written_tmp, _ubidrv_uart_ring_get_capacity(&uart_file->write_ring) / 2);
+            if (_ubidrv_uart_ring_get_free_len(&uart_file->write_ring) >= uart_file->tx_space_level)
+            {
+                continue;
+            }
+
+            _ubidrv_uart_sem_take_timedms(uart_file, uart_file->space_sem, timeoutms);
+            timeoutms = task_getremainingtimeoutms();
         }
 
-        written_tmp = 0;
+        uart_file->tx_space_level = 0;
 
-        ubi_err = cbuf_write(uart_file->write_cbuf, buffer, length, &written_tmp);
-        assert(ubi_err == UBI_ST_OK || ubi_err == UBI_ST_ERR_BUF_FULL);
-        if (written_tmp == 0)
+        if (written)
         {
-            uart_file->tx_overflow_count++;
+            *written = written_tmp;
         }
-        else
+
+        if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
         {
-            if (uart_file->need_tx_restart)
+            if (remain_timeoutms)
             {
-                buf = cbuf_get_head_addr(uart_file->write_cbuf);
-                uart_file->need_tx_restart = 0;
-                for (uint32_t i = 0;; i++)
-                {
-                    if (HAL_UART_Transmit_IT(uart_file->hal_uart, buf, 1) == HAL_OK)
-                    {
-                        break;
-                    }
-                    if (i >= 99)
-                    {
-                        uart_file->need_tx_restart = 1;
-                        ubi_err = UBI_ST_ERR_IO;
-                        break;
-                    }
-                }
+                *remain_timeoutms = timeoutms;
             }
         }
 
+        r = mutex_unlock(uart_file->put_lock);
+        assert(r == 0);
+    } while (0);
+
+    return ubi_err;
+}
+
+static ubi_st_t ubidrv_uart_io_writev_advan(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *written, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t ubi_err;
+    int r;
+    uint32_t length;
+    uint32_t vi;
+    assert(vec != NULL || count == 0);
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * uart_file = &_g_ubidrv_uart_files[fd - 1];
+    ubi_assert(uart_file->init == 1);
+
+    length = 0;
+    for (vi = 0; vi < count; vi++)
+    {
+        assert(vec[vi].buf != NULL || vec[vi].len == 0);
+        length += vec[vi].len;
+    }
+
+    do
+    {
         if (written)
         {
-            *written = written_tmp;
+            *written = 0;
+        }
+
+        if (length <= 0)
+        {
+            ubi_err = UBI_ST_OK;
+            break;
+        }
+
+        if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
+        {
+            r = mutex_lock_timedms(uart_file->put_lock, timeoutms);
+            timeoutms = task_getremainingtimeoutms();
+            if (r == UBIK_ERR__TIMEOUT)
+            {
+                ubi_err = UBI_ST_TIMEOUT;
+                break;
+            }
+            assert(r == 0);
+        }
+        else
+        {
+            r = mutex_lock(uart_file->put_lock);
+            assert(r == 0);
+        }
+
+        /* All regions go in under one lock hold or none of them does, so a frame is never split or interleaved.
+         * Timed writes wait for the transmitter to drain until all of them fit or the timeout expires. */
+        for (;;)
+        {
+            if (uart_file->need_reset)
+            {
+                _ubidrv_uart_reset(fd);
+            }
+
+            if (length <= _ubidrv_uart_ring_get_free_len(&uart_file->write_ring))
+            {
+                if (_ubidrv_uart_tx_is_idle(uart_file))
+                {
+                    sem_clear(uart_file->write_sem);
+                    uart_file->need_tx_restart = 1;
+                }
+
+                for (vi = 0; vi < count; vi++)
+                {
+                    _ubidrv_uart_ring_write(&uart_file->write_ring, vec[vi].buf, vec[vi].len);
+                }
+
+                if (written)
+                {
+                    *written = length;
+                }
+
+                ubi_err = ubidrv_uart_io_tx_kick(fd, uart_file);
+                break;
+            }
+
+            if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) == 0 || length > _ubidrv_uart_ring_get_capacity(&uart_file->write_ring))
+            {
+                uart_file->tx_overflow_count++;
+                ubi_err = UBI_ST_ERR_BUF_FULL;
+                break;
+            }
+
+            if (timeoutms == 0)
+            {
+                ubi_err = UBI_ST_TIMEOUT;
+                break;
+            }
+
+            /* Restart a transmitter stopped by a reset, as the buffer only drains while it runs */
+            ubi_err = ubidrv_uart_io_tx_kick(fd, uart_file);
+            if (ubi_err != UBI_ST_OK)
+            {
+                break;
+            }
+
+            sem_clear(uart_file->space_sem);
+            uart_file->tx_space_level = length;
+            if (_ubidrv_uart_ring_get_free_len(&uart_file->write_ring) >= uart_file->tx_space_level)
+            {
+                continue;
+            }
+
+            _ubidrv_uart_sem_take_timedms(uart_file, uart_file->space_sem, timeoutms);
+            timeoutms = task_getremainingtimeoutms();
         }
 
+        uart_file->tx_space_level = 0;
+
         if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
         {
             if (remain_timeoutms)
@@ -228,6 +440,28 @@ static ubi_st_t ubidrv_uart_io_write_advan(int fd, uint8_t *buffer, uint32_t len
     return ubi_err;
 }
 
+/* Start transmission of what was just put in the write buffer if the transmitter was idle. Called with put_lock held. */
+static ubi_st_t ubidrv_uart_io_tx_kick(int fd, ubidrv_uart_file_t * uart_file)
+{
+    if (uart_file->need_tx_restart)
+    {
+        for (uint32_t i = 0;; i++)
+        {
+            _ubidrv_uart_tx_start(fd);
+            if (!uart_file->need_tx_restart || _ubidrv_uart_ring_get_len(&uart_file->write_ring) == 0)
+            {
+                break;
+            }
+            if (i >= 99)
+            {
+                return UBI_ST_ERR_IO;
+            }
+        }
+    }
+
+    return UBI_ST_OK;
+}
+
 static ubi_st_t ubidrv_uart_io_read_buf_clear_advan(int fd, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
     ubi_st_t ubi_err;
@@ -235,7 +469,7 @@ static ubi_st_t ubidrv_uart_io_read_buf_clear_advan(int fd, uint16_t io_option,
     (void) r;
     (void) ubi_err;
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * uart_file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(uart_file->init == 1);
 
@@ -258,8 +492,9 @@ static ubi_st_t ubidrv_uart_io_read_buf_clear_advan(int fd, uint16_t io_option,
             assert(r == 0);
         }
 
-        ubi_err = cbuf_clear(uart_file->read_cbuf);
-        assert(ubi_err == UBI_ST_OK);
+        _ubidrv_uart_ring_clear(&uart_file->read_ring);
+        ubi_err = UBI_ST_OK;
+        _ubidrv_uart_rx_flow_resume(fd);
 
         if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
         {
@@ -283,7 +518,7 @@ static ubi_st_t ubidrv_uart_io_flush_advan(int fd, uint16_t io_option, uint32_t
     (void) r;
     (void) ubi_err;
 
-    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_NUM);
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
     ubidrv_uart_file_t * uart_file = &_g_ubidrv_uart_files[fd - 1];
     ubi_assert(uart_file->init == 1);
 
@@ -310,19 +545,156 @@ static ubi_st_t ubidrv_uart_io_flush_advan(int fd, uint16_t io_option, uint32_t
 
         for (;;)
         {
-            if (cbuf_get_len(uart_file->write_cbuf) == 0)
+            if (uart_file->need_reset)
+            {
+                _ubidrv_uart_reset(fd);
+            }
+
+            if (uart_file->need_tx_restart && _ubidrv_uart_ring_get_len(&uart_file->write_ring) > 0)
+            {
+                _ubidrv_uart_tx_start(fd);
+            }
+
+            if (_ubidrv_uart_ring_get_len(&uart_file->write_ring) == 0)
             {
                 break;
             }
-            r = sem_take_timedms(uart_file->write_sem, timeoutms);
+
+            if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
+            {
+                if (timeoutms == 0)
+                {
+                    ubi_err = UBI_ST_TIMEOUT;
+                    break;
+                }
+                r = _ubidrv_uart_sem_take_timedms(uart_file, uart_file->write_sem, timeoutms);
+                timeoutms = task_getremainingtimeoutms();
+                if (r == UBIK_ERR__TIMEOUT)
+                {
+                    ubi_err = UBI_ST_TIMEOUT;
+                    break;
+                }
+            }
+            else
+            {
+                _ubidrv_uart_sem_take(uart_file, uart_file->write_sem);
+            }
+        }
+
+        if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
+        {
+            if (remain_timeoutms)
+            {
+                *remain_timeoutms = timeoutms;
+            }
+        }
+
+        r = mutex_unlock(uart_file->put_lock);
+        assert(r == 0);
+    } while (0);
+
+    return ubi_err;
+}
+
+static ubi_st_t ubidrv_uart_io_read_acquire_advan(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t ubi_err;
+    int r;
+    uint32_t len;
+    uint32_t gapms;
+    int gap_expired = 0;
+    assert(vec != NULL);
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * uart_file = &_g_ubidrv_uart_files[fd - 1];
+    ubi_assert(uart_file->init == 1);
+
+    do
+    {
+        if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
+        {
+            r = mutex_lock_timedms(uart_file->get_lock, timeoutms);
             timeoutms = task_getremainingtimeoutms();
             if (r == UBIK_ERR__TIMEOUT)
             {
                 ubi_err = UBI_ST_TIMEOUT;
                 break;
             }
+            assert(r == 0);
+        }
+        else
+        {
+            r = mutex_lock(uart_file->get_lock);
+            assert(r == 0);
+        }
+
+        for (;;)
+        {
+            if (uart_file->need_reset)
+            {
+                _ubidrv_uart_reset(fd);
+            }
+
+            if (uart_file->need_rx_restart)
+            {
+                _ubidrv_uart_rx_start(fd);
+            }
+
+            len = _ubidrv_uart_ring_get_len(&uart_file->read_ring);
+            if (len > 0 && (len >= uart_file->rx_wake_threshold || gap_expired))
+            {
+                ubi_err = UBI_ST_OK;
+                break;
+            }
+
+            _ubidrv_uart_set_rx_wake_level(uart_file, uart_file->rx_wake_threshold);
+            if (_ubidrv_uart_ring_get_len(&uart_file->read_ring) != len)
+            {
+                continue;
+            }
+
+            /* The inter-byte timeout starts with the first received byte */
+            gapms = (len > 0) ? uart_file->rx_wake_timeoutms : 0;
+
+            if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
+            {
+                if (timeoutms == 0)
+                {
+                    ubi_err = UBI_ST_TIMEOUT;
+                    break;
+                }
+                r = _ubidrv_uart_sem_take_timedms(uart_file, uart_file->read_sem, (gapms > 0) ? min(timeoutms, gapms) : timeoutms);
+                timeoutms = task_getremainingtimeoutms();
+                if (r == UBIK_ERR__TIMEOUT)
+                {
+                    if (gapms > 0 && _ubidrv_uart_ring_get_len(&uart_file->read_ring) == len)
+                    {
+                        gap_expired = 1;
+                        continue;
+                    }
+                    if (timeoutms == 0)
+                    {
+                        ubi_err = UBI_ST_TIMEOUT;
+                        break;
+                    }
+                }
+            }
+            else if (gapms > 0)
+            {
+                r = _ubidrv_uart_sem_take_timedms(uart_file, uart_file->read_sem, gapms);
+                if (r == UBIK_ERR__TIMEOUT && _ubidrv_uart_ring_get_len(&uart_file->read_ring) == len)
+                {
+                    gap_expired = 1;
+                }
+            }
+            else
+            {
+                _ubidrv_uart_sem_take(uart_file, uart_file->read_sem);
+            }
         }
 
+        uart_file->rx_wake_level = 1;
+
         if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
         {
             if (remain_timeoutms)
@@ -331,8 +703,91 @@ static ubi_st_t ubidrv_uart_io_flush_advan(int fd, uint16_t io_option, uint32_t
             }
         }
 
-        r = mutex_unlock(uart_file->put_lock);
-        assert(r == 0);
+        if (ubi_err != UBI_ST_OK)
+        {
+            r = mutex_unlock(uart_file->get_lock);
+            assert(r == 0);
+            break;
+        }
+
+        vec[0].buf = _ubidrv_uart_ring_get_span(&uart_file->read_ring, 0, len, &vec[0].len);
+        vec[1].buf = _ubidrv_uart_ring_get_span(&uart_file->read_ring, vec[0].len, len - vec[0].len, &vec[1].len);
+
+        if (length)
+        {
+            *length = len;
+        }
+
+        uart_file->read_acquired = 1;
+    } while (0);
+
+    return ubi_err;
+}
+
+static ubi_st_t ubidrv_uart_io_write_reserve_advan(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length, uint16_t io_option, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    ubi_st_t ubi_err;
+    int r;
+    uint32_t len;
+    assert(vec != NULL);
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * uart_file = &_g_ubidrv_uart_files[fd - 1];
+    ubi_assert(uart_file->init == 1);
+
+    do
+    {
+        if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
+        {
+            r = mutex_lock_timedms(uart_file->put_lock, timeoutms);
+            timeoutms = task_getremainingtimeoutms();
+            if (r == UBIK_ERR__TIMEOUT)
+            {
+                ubi_err = UBI_ST_TIMEOUT;
+                break;
+            }
+            assert(r == 0);
+        }
+        else
+        {
+            r = mutex_lock(uart_file->put_lock);
+            assert(r == 0);
+        }
+
+        if ((io_option & UBIDRV_UART_IO_OPTION__TIMED) != 0)
+        {
+            if (remain_timeoutms)
+            {
+                *remain_timeoutms = timeoutms;
+            }
+        }
+
+        if (uart_file->need_reset)
+        {
+            _ubidrv_uart_reset(fd);
+        }
+
+        len = _ubidrv_uart_ring_get_free_len(&uart_file->write_ring);
+        if (len == 0)
+        {
+            uart_file->tx_overflow_count++;
+            r = mutex_unlock(uart_file->put_lock);
+            assert(r == 0);
+            ubi_err = UBI_ST_ERR_BUF_FULL;
+            break;
+        }
+
+        vec[0].buf = _ubidrv_uart_ring_get_free_span(&uart_file->write_ring, 0, len, &vec[0].len);
+        vec[1].buf = _ubidrv_uart_ring_get_free_span(&uart_file->write_ring, vec[0].len, len - vec[0].len, &vec[1].len);
+
+        if (length)
+        {
+            *length = len;
+        }
+
+        uart_file->write_reserved = 1;
+
+        ubi_err = UBI_ST_OK;
     } while (0);
 
     return ubi_err;
@@ -340,12 +795,28 @@ static ubi_st_t ubidrv_uart_io_flush_advan(int fd, uint16_t io_option, uint32_t
 
 ubi_st_t ubidrv_uart_io_read(int fd, uint8_t *buffer, uint32_t length, uint32_t *read)
 {
-    return ubidrv_uart_io_read_advan(fd, buffer, length, read, 0, 0, NULL);
+    ubidrv_uart_io_vec_t vec = { buffer, length };
+    assert(buffer != NULL);
+
+    return ubidrv_uart_io_readv_advan(fd, &vec, 1, read, 0, 0, NULL);
 }
 
 ubi_st_t ubidrv_uart_io_read_timedms(int fd, uint8_t *buffer, uint32_t length, uint32_t *read, uint32_t timeoutms, uint32_t *remain_timeoutms)
 {
-    return ubidrv_uart_io_read_advan(fd, buffer, length, read, UBIDRV_UART_IO_OPTION__TIMED, timeoutms, remain_timeoutms);
+    ubidrv_uart_io_vec_t vec = { buffer, length };
+    assert(buffer != NULL);
+
+    return ubidrv_uart_io_readv_advan(fd, &vec, 1, read, UBIDRV_UART_IO_OPTION__TIMED, timeoutms, remain_timeoutms);
+}
+
+ubi_st_t ubidrv_uart_io_readv(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *read)
+{
+    return ubidrv_uart_io_readv_advan(fd, vec, count, read, 0, 0, NULL);
+}
+
+ubi_st_t ubidrv_uart_io_readv_timedms(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *read, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    return ubidrv_uart_io_readv_advan(fd, vec, count, read, UBIDRV_UART_IO_OPTION__TIMED, timeoutms, remain_timeoutms);
 }
 
 ubi_st_t ubidrv_uart_io_write(int fd, uint8_t *buffer, uint32_t length, uint32_t *written)
@@ -358,6 +829,16 @@ ubi_st_t ubidrv_uart_io_write_timedms(int fd, uint8_t *buffer, uint32_t length,
     return ubidrv_uart_io_write_advan(fd, buffer, length, written, UBIDRV_UART_IO_OPTION__TIMED, timeoutms, remain_timeoutms);
 }
 
+ubi_st_t ubidrv_uart_io_writev(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *written)
+{
+    return ubidrv_uart_io_writev_advan(fd, vec, count, written, 0, 0, NULL);
+}
+
+ubi_st_t ubidrv_uart_io_writev_timedms(int fd, const ubidrv_uart_io_vec_t *vec, uint32_t count, uint32_t *written, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    return ubidrv_uart_io_writev_advan(fd, vec, count, written, UBIDRV_UART_IO_OPTION__TIMED, timeoutms, remain_timeoutms);
+}
+
 ubi_st_t ubidrv_uart_io_read_buf_clear(int fd)
 {
     return ubidrv_uart_io_read_buf_clear_advan(fd, 0, 0, NULL);
@@ -378,6 +859,113 @@ ubi_st_t ubidrv_uart_io_flush_timedms(int fd, uint32_t timeoutms, uint32_t *rema
     return ubidrv_uart_io_flush_advan(fd, UBIDRV_UART_IO_OPTION__TIMED, timeoutms, remain_timeoutms);
 }
 
+ubi_st_t ubidrv_uart_io_read_acquire(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length)
+{
+    return ubidrv_uart_io_read_acquire_advan(fd, vec, length, 0, 0, NULL);
+}
+
+ubi_st_t ubidrv_uart_io_read_acquire_timedms(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    return ubidrv_uart_io_read_acquire_advan(fd, vec, length, UBIDRV_UART_IO_OPTION__TIMED, timeoutms, remain_timeoutms);
+}
+
+ubi_st_t ubidrv_uart_io_read_commit(int fd, uint32_t length)
+{
+    ubi_st_t ubi_err;
+    int r;
+    (void) r;
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * uart_file = &_g_ubidrv_uart_files[fd - 1];
+    ubi_assert(uart_file->init == 1);
+
+    do
+    {
+        if (!uart_file->read_acquired)
+        {
+            ubi_err = UBI_ST_ERR_INVALID_STATE;
+            break;
+        }
+
+        assert(length <= _ubidrv_uart_ring_get_len(&uart_file->read_ring));
+
+        ubi_err = UBI_ST_OK;
+        if (length > 0)
+        {
+            _ubidrv_uart_ring_read(&uart_file->read_ring, NULL, length);
+            _ubidrv_uart_rx_flow_resume(fd);
+        }
+
+        uart_file->read_acquired = 0;
+
+        r = mutex_unlock(uart_file->get_lock);
+        assert(r == 0);
+    } while (0);
+
+    return ubi_err;
+}
+
+ubi_st_t ubidrv_uart_io_write_reserve(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length)
+{
+    return ubidrv_uart_io_write_reserve_advan(fd, vec, length, 0, 0, NULL);
+}
+
+ubi_st_t ubidrv_uart_io_write_reserve_timedms(int fd, ubidrv_uart_io_vec_t vec[2], uint32_t *length, uint32_t timeoutms, uint32_t *remain_timeoutms)
+{
+    return ubidrv_uart_io_write_reserve_advan(fd, vec, length, UBIDRV_UART_IO_OPTION__TIMED, timeoutms, remain_timeoutms);
+}
+
+ubi_st_t ubidrv_uart_io_write_commit(int fd, uint32_t length)
+{
+    ubi_st_t ubi_err;
+    int r;
+    (void) r;
+
+    ubi_assert(0 < fd && fd <= UBIDRV_UART_FILE_SLOT_NUM);
+    ubidrv_uart_file_t * uart_file = &_g_ubidrv_uart_files[fd - 1];
+    ubi_assert(uart_file->init == 1);
+
+    do
+    {
+        if (!uart_file->write_reserved)
+        {
+            ubi_err = UBI_ST_ERR_INVALID_STATE;
+            break;
+        }
+
+        assert(length <= _ubidrv_uart_ring_get_free_len(&uart_file->write_ring));
+
+        ubi_err = UBI_ST_OK;
+        if (length > 0)
+        {
+            if (_ubidrv_uart_tx_is_idle(uart_file))
+            {
+                sem_clear(uart_file->write_sem);
+                uart_file->need_tx_restart = 1;
+            }
+
+            _ubidrv_uart_ring_write(&uart_file->write_ring, NULL, length);
+        }
+
+        /* Also restarts a transmitter stopped by a reset in write_reserve */
+        if (uart_file->need_tx_restart && _ubidrv_uart_ring_get_len(&uart_file->write_ring) > 0)
+        {
+            _ubidrv_uart_tx_start(fd);
+            if (uart_file->need_tx_restart)
+            {
+                ubi_err = UBI_ST_ERR_IO;
+            }
+        }
+
+        uart_file->write_reserved = 0;
+
+        r = mutex_unlock(uart_file->put_lock);
+        assert(r == 0);
+    } while (0);
+
+    return ubi_err;
+}
+
 #endif /* (UBINOS__BSP__BOARD_MODEL == UBINOS__BSP__BOARD_MODEL__NUCLEOF207ZG) */
 #endif /* (UBINOS__UBIDRV__INCLUDE_UART_IO == 1) */
 
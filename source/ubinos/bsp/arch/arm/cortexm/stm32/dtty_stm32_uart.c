@@ -18,195 +18,377 @@
     #error "ubik is necessary"
 #endif
 
+/* Boards with the ubidrv uart driver (see dtty_stm32_uart_hal.c for the others) */
+#if (UBINOS__UBIDRV__INCLUDE_UART == 1) && (UBINOS__BSP__BOARD_MODEL == UBINOS__BSP__BOARD_MODEL__NUCLEOF207ZG)
+
 #include <ubinos/bsp.h>
 #include <ubinos/bsp/arch.h>
 #include <ubinos/bsp_ubik.h>
+#include <ubinos/ubidrv/uart.h>
+#include <ubinos/ubidrv/uart_io.h>
+
+#include <stm32cubef2_extension/ubidrv/uart.h>
+#include <stm32cubef2_extension/dtty_stm32_uart.h>
 
 #include <assert.h>
+#include <string.h>
+#if (STM32CUBEF2__DTTY_STM32_UART_NEWLIB_WRITE == 1)
+#include <errno.h>
+#include <unistd.h>
+#endif
 
 #include "main.h"
 
-#define SLEEP_TIMEMS	1
+/*
+ * The console is a ubidrv uart port (UBIDRV_UART_CONSOLE_FILE_NAME) on DTTY_STM32_UART_HANDLE,
+ * so it shares the receive/transmit engine, error recovery and statistics of ubidrv.
+ * Only the echo and autocr policy of dtty is kept here.
+ */
 
 extern int _g_bsp_dtty_init;
 extern int _g_bsp_dtty_in_init;
 extern int _g_bsp_dtty_echo;
 extern int _g_bsp_dtty_autocr;
 
-#define DTTY_UART_CHECK_INTERVAL_MS 1000
+#define DTTY_UART_READ_BUFFER_SIZE STM32CUBEF2__DTTY_STM32_UART_READ_BUFFER_SIZE
+#define DTTY_UART_WRITE_BUFFER_SIZE STM32CUBEF2__DTTY_STM32_UART_WRITE_BUFFER_SIZE
 
-cbuf_def_init(_g_dtty_uart_rbuf, STM32CUBEF2__DTTY_STM32_UART_READ_BUFFER_SIZE);
-cbuf_def_init(_g_dtty_uart_wbuf, STM32CUBEF2__DTTY_STM32_UART_WRITE_BUFFER_SIZE);
+#if ((DTTY_UART_READ_BUFFER_SIZE) & ((DTTY_UART_READ_BUFFER_SIZE) - 1)) != 0
+    #error "STM32CUBEF2__DTTY_STM32_UART_READ_BUFFER_SIZE must be a power of two"
+#endif
+#if ((DTTY_UART_WRITE_BUFFER_SIZE) & ((DTTY_UART_WRITE_BUFFER_SIZE) - 1)) != 0
+    #error "STM32CUBEF2__DTTY_STM32_UART_WRITE_BUFFER_SIZE must be a power of two"
+#endif
 
-sem_pt _g_dtty_uart_rsem = NULL;
-sem_pt _g_dtty_uart_wsem = NULL;
+#define DTTY_UART_LOG_BUFFER_SIZE STM32CUBEF2__DTTY_STM32_UART_LOG_BUFFER_SIZE
 
-mutex_pt _g_dtty_uart_putlock = NULL;
-mutex_pt _g_dtty_uart_getlock = NULL;
-mutex_pt _g_dtty_uart_resetlock = NULL;
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
 
-uint32_t _g_dtty_uart_rx_overflow_count = 0;
-uint32_t _g_dtty_uart_tx_overflow_count = 0;
-uint32_t _g_dtty_uart_reset_count = 0;
+#if (UBINOS__UBIDRV__INCLUDE_UART_IO != 1)
+    #error "ubidrv uart io is necessary for STM32CUBEF2__DTTY_STM32_UART_LOG_BUFFER_SIZE"
+#endif
 
-uint8_t _g_dtty_uart_need_reset = 0;
-uint8_t _g_dtty_uart_need_rx_restart = 0;
-uint8_t _g_dtty_uart_need_tx_restart = 0;
+/* Payload bytes per record (longer writes are split) */
+#define DTTY_UART_LOG_RECORD_MAX 256
 
-static void _dtty_stm32_uart_reset(void);
-static int _dtty_getc_advan(char *ch_p, int blocked);
+#if ((DTTY_UART_LOG_BUFFER_SIZE) & ((DTTY_UART_LOG_BUFFER_SIZE) - 1)) != 0 || (DTTY_UART_LOG_BUFFER_SIZE) < 2 * (DTTY_UART_LOG_RECORD_MAX + 4)
+    #error "STM32CUBEF2__DTTY_STM32_UART_LOG_BUFFER_SIZE must be 0 or a power of two of at least 1024"
+#endif
 
-static void _dtty_stm32_uart_reset(void)
-{
-    HAL_StatusTypeDef stm_err;
-    (void) stm_err;
+#define DTTY_UART_LOG_READY         0x80000000
+#define DTTY_UART_LOG_PAD           0x40000000
+#define DTTY_UART_LOG_LEN_MASK      0x00FFFFFF
 
-    mutex_lock(_g_dtty_uart_resetlock);
+#define DTTY_UART_WRITE_TASK_STACK_DEPTH    256
+#define DTTY_UART_WRITE_TIMEOUTMS           1000
+#define DTTY_UART_KICK_POLL_MS              100
 
-    if (_g_dtty_uart_need_reset)
-    {
-        DTTY_STM32_UART_HANDLE.Instance = DTTY_STM32_UART;
-        DTTY_STM32_UART_HANDLE.Init.BaudRate = 115200;
-        DTTY_STM32_UART_HANDLE.Init.WordLength = UART_WORDLENGTH_8B;
-        DTTY_STM32_UART_HANDLE.Init.StopBits = UART_STOPBITS_1;
-        DTTY_STM32_UART_HANDLE.Init.Parity = UART_PARITY_NONE;
-        DTTY_STM32_UART_HANDLE.Init.HwFlowCtl = UART_HWCONTROL_NONE;
-        DTTY_STM32_UART_HANDLE.Init.Mode = UART_MODE_TX_RX;
-        DTTY_STM32_UART_HANDLE.Init.OverSampling = UART_OVERSAMPLING_16;
+/*
+ * Deferred output
+ *
+ * Writers append records (a header word, then the payload padded to a word) to _g_dtty_uart_log_buf
+ * and never touch the uart. A record is reserved by moving head with LDREX/STREX, filled, and then published
+ * by setting DTTY_UART_LOG_READY in its header, so writers only contend on the head word.
+ * A record that would cross the end of the buffer is preceded by a DTTY_UART_LOG_PAD record up to the end.
+ *
+ * dtty_write_process (run by a lowest priority task) takes published records in order from tail, writes them
+ * to the port, zeroes their space and moves tail. The free space is always zero, so a header that
+ * a writer has reserved but not yet published reads as not ready.
+ * A writer wakes the task when tail is at its record, i.e. when the task may have stopped there.
+ *
+ * Reserving and publishing take no lock and call no kernel service, so writers may also be isrs or
+ * run in critical sections. Those cannot wake the task themselves; they leave _g_dtty_uart_log_kick_pending
+ * for the next task-level writer, the console isr callbacks or the task's own periodic check.
+ */
+static uint32_t _g_dtty_uart_log_buf[DTTY_UART_LOG_BUFFER_SIZE / 4];
+static volatile uint32_t _g_dtty_uart_log_head = 0;
+static volatile uint32_t _g_dtty_uart_log_tail = 0;
+static volatile uint8_t _g_dtty_uart_log_kick_pending = 0;
+static sem_pt _g_dtty_uart_log_sem = NULL;
+static mutex_pt _g_dtty_uart_log_lock = NULL;
 
-        stm_err = HAL_UART_DeInit(&DTTY_STM32_UART_HANDLE);
-        assert(stm_err == HAL_OK);
+uint32_t _g_dtty_uart_log_drop_count = 0;
 
-        _g_dtty_uart_need_reset = 0;
-        _g_dtty_uart_need_tx_restart = 1;
-        _g_dtty_uart_need_rx_restart = 1;
+#endif /* (DTTY_UART_LOG_BUFFER_SIZE > 0) */
 
-        stm_err = HAL_UART_Init(&DTTY_STM32_UART_HANDLE);
-        assert(stm_err == HAL_OK);
+static uint8_t _g_dtty_uart_read_buffer[UBIDRV_UART_BUFFER_STORAGE_SIZE(DTTY_UART_READ_BUFFER_SIZE)];
+static uint8_t _g_dtty_uart_write_buffer[UBIDRV_UART_BUFFER_STORAGE_SIZE(DTTY_UART_WRITE_BUFFER_SIZE)];
 
-        HAL_NVIC_SetPriority(DTTY_STM32_UART_IRQn, NVIC_PRIO_MIDDLE, 0);
+static ubidrv_uart_t _g_dtty_uart =
+{
+    .file_name = UBIDRV_UART_CONSOLE_FILE_NAME,
+    .fd = 0,
+};
 
-        _g_dtty_uart_reset_count++;
-    }
+/* Set by dtty_stm32_uart_panic; all output is then written synchronously by polling */
+static volatile uint8_t _g_dtty_uart_panic = 0;
 
-    mutex_unlock(_g_dtty_uart_resetlock);
-}
+static void _dtty_apply_policy(void);
+static int _dtty_getc_advan(char *ch_p, int blocked);
+static void _dtty_write(const uint8_t * data, uint32_t len);
+static void _dtty_emit(const uint8_t * data, uint32_t len);
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+static uint32_t _dtty_log_put(const uint8_t * data, uint32_t len);
+static void _dtty_log_kick(void);
+static void _dtty_write_task(void * arg);
+#endif
 
-void dtty_stm32_uart_rx_callback(void)
+/* The console policy lives in the bsp dtty globals (dtty_setecho, dtty_setautocr), so it is pushed down to the port on use */
+static void _dtty_apply_policy(void)
 {
-    uint8_t *buf;
-    uint16_t len;
-    cbuf_pt rbuf = _g_dtty_uart_rbuf;
-    sem_pt rsem = _g_dtty_uart_rsem;
-    int need_signal = 0;
+    int fd = _g_dtty_uart.fd;
+    int echo;
+
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+    /* The port does not echo; _dtty_getc_advan queues the echo behind the deferred output instead */
+    echo = 0;
+#else
+    echo = (_g_bsp_dtty_echo != 0);
+#endif
 
-    do
+    if (ubidrv_uart_getecho(fd) != echo)
+    {
+        ubidrv_uart_setecho(fd, echo);
+    }
+    if (ubidrv_uart_getautocr(fd) != (_g_bsp_dtty_autocr != 0))
     {
-        if (DTTY_STM32_UART_HANDLE.ErrorCode != HAL_UART_ERROR_NONE)
+        ubidrv_uart_setautocr(fd, _g_bsp_dtty_autocr != 0);
+    }
+}
+
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+
+/* Append data as records. Returns the number of bytes taken; the rest is dropped and counted when the buffer is full. */
+static uint32_t _dtty_log_put(const uint8_t * data, uint32_t len)
+{
+    uint32_t done = 0;
+    uint32_t n;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t pos;
+    uint32_t pad;
+    uint32_t drop;
+    int full;
+
+    while (done < len)
+    {
+        n = min(len - done, DTTY_UART_LOG_RECORD_MAX);
+        size = 4 + ((n + 3) & ~3);
+
+        full = 0;
+        do
         {
-            break;
-        }
+            head = __LDREXW((uint32_t *) &_g_dtty_uart_log_head);
+            tail = _g_dtty_uart_log_tail;
+            pos = head & (DTTY_UART_LOG_BUFFER_SIZE - 1);
+            pad = (DTTY_UART_LOG_BUFFER_SIZE - pos < size) ? DTTY_UART_LOG_BUFFER_SIZE - pos : 0;
+            if (head + pad + size - tail > DTTY_UART_LOG_BUFFER_SIZE)
+            {
+                __CLREX();
+                full = 1;
+                break;
+            }
+        } while (__STREXW(head + pad + size, (uint32_t *) &_g_dtty_uart_log_head) != 0);
 
-        if (_g_dtty_uart_need_reset)
+        if (full)
         {
             break;
         }
 
-        if (_g_dtty_uart_need_rx_restart)
+        if (pad > 0)
         {
-            bsp_abortsystem();
+            _g_dtty_uart_log_buf[pos / 4] = DTTY_UART_LOG_READY | DTTY_UART_LOG_PAD | pad;
+            pos = 0;
         }
 
-        len = 1;
+        memcpy((uint8_t *) &_g_dtty_uart_log_buf[pos / 4 + 1], &data[done], n);
+        __DMB();
+        _g_dtty_uart_log_buf[pos / 4] = DTTY_UART_LOG_READY | n;
+        __DMB();
 
-        if (cbuf_is_full(rbuf))
+        tail = _g_dtty_uart_log_tail;
+        if (tail == head || tail == head + pad)
         {
-            _g_dtty_uart_rx_overflow_count++;
+            _dtty_log_kick();
         }
-        else
+
+        done += n;
+    }
+
+    if (done < len)
+    {
+        do
         {
-            if (cbuf_get_len(rbuf) == 0)
-            {
-                need_signal = 1;
-            }
+            drop = __LDREXW(&_g_dtty_uart_log_drop_count);
+        } while (__STREXW(drop + len - done, &_g_dtty_uart_log_drop_count) != 0);
+    }
 
-            cbuf_write(rbuf, NULL, len, NULL);
+    if (_g_dtty_uart_log_kick_pending)
+    {
+        _dtty_log_kick();
+    }
 
-            if (need_signal && _bsp_kernel_active)
-            {
-                sem_give(rsem);
-            }
-        }
+    return done;
+}
 
-        buf = cbuf_get_tail_addr(rbuf);
-        _g_dtty_uart_need_rx_restart = 0;
-        if (HAL_UART_Receive_IT(&DTTY_STM32_UART_HANDLE, buf, len) != HAL_OK)
-        {
-            _g_dtty_uart_need_rx_restart = 1;
-            break;
-        }
-    } while (0);
+/* Wake the writer task, or leave it pending when the caller may not call the kernel */
+static void _dtty_log_kick(void)
+{
+    if (bsp_isintr() || 0 != _bsp_critcount || _g_dtty_uart_log_sem == NULL)
+    {
+        _g_dtty_uart_log_kick_pending = 1;
+        return;
+    }
+
+    _g_dtty_uart_log_kick_pending = 0;
+    sem_give(_g_dtty_uart_log_sem);
 }
 
-void dtty_stm32_uart_tx_callback(void)
+static void _dtty_write_task(void * arg)
 {
-    uint8_t *buf;
-    uint16_t len;
-    cbuf_pt wbuf = _g_dtty_uart_wbuf;
-    sem_pt wsem = _g_dtty_uart_wsem;
+    for (;;)
+    {
+        sem_take_timedms(_g_dtty_uart_log_sem, DTTY_UART_KICK_POLL_MS);
+        _g_dtty_uart_log_kick_pending = 0;
+        dtty_write_process(NULL);
+    }
+}
 
-    do
+#endif /* (DTTY_UART_LOG_BUFFER_SIZE > 0) */
+
+/* Write to the port: by polling after dtty_stm32_uart_panic, otherwise waiting for space in its write buffer */
+static void _dtty_write(const uint8_t * data, uint32_t len)
+{
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+    ubi_st_t ubi_err;
+    uint32_t written;
+#endif
+
+    if (_g_dtty_uart_panic)
+    {
+        ubidrv_uart_write_polled(_g_dtty_uart.fd, data, len);
+        return;
+    }
+
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+    while (len > 0)
     {
-        if (DTTY_STM32_UART_HANDLE.ErrorCode != HAL_UART_ERROR_NONE)
+        written = 0;
+        ubi_err = ubidrv_uart_io_write_timedms(_g_dtty_uart.fd, (uint8_t *) data, len, &written, DTTY_UART_WRITE_TIMEOUTMS, NULL);
+        data += written;
+        len -= written;
+        if (ubi_err != UBI_ST_OK && ubi_err != UBI_ST_TIMEOUT)
         {
             break;
         }
+    }
+#endif
+}
+
+/* Write data, expanding each newline to CR LF when autocr is set */
+static void _dtty_emit(const uint8_t * data, uint32_t len)
+{
+    const uint8_t * end = data + len;
+    const uint8_t * nl;
 
-        if (_g_dtty_uart_need_reset)
+    while (data < end)
+    {
+        nl = (0 != _g_bsp_dtty_autocr) ? memchr(data, '\n', end - data) : NULL;
+        _dtty_write(data, ((nl != NULL) ? nl : end) - data);
+        if (nl == NULL)
         {
             break;
         }
+        _dtty_write((const uint8_t *) "\r\n", 2);
+        data = nl + 1;
+    }
+}
 
-        if (_g_dtty_uart_need_tx_restart)
-        {
-            bsp_abortsystem();
-        }
+void dtty_stm32_uart_rx_callback(void)
+{
+    if (_g_dtty_uart.fd > 0)
+    {
+        ubidrv_uart_rx_callback(_g_dtty_uart.fd);
+    }
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+    if (_g_dtty_uart_log_kick_pending && _g_dtty_uart_log_sem != NULL)
+    {
+        _g_dtty_uart_log_kick_pending = 0;
+        sem_give(_g_dtty_uart_log_sem);
+    }
+#endif
+}
+
+void dtty_stm32_uart_tx_callback(void)
+{
+    if (_g_dtty_uart.fd > 0)
+    {
+        ubidrv_uart_tx_callback(_g_dtty_uart.fd);
+    }
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+    if (_g_dtty_uart_log_kick_pending && _g_dtty_uart_log_sem != NULL)
+    {
+        _g_dtty_uart_log_kick_pending = 0;
+        sem_give(_g_dtty_uart_log_sem);
+    }
+#endif
+}
+
+void dtty_stm32_uart_err_callback(void)
+{
+    if (_g_dtty_uart.fd > 0)
+    {
+        ubidrv_uart_err_callback(_g_dtty_uart.fd);
+    }
+}
 
-        len = 1;
+void dtty_stm32_uart_panic(void)
+{
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+    uint32_t tail;
+    uint32_t pos;
+    uint32_t hdr;
+    uint32_t size;
+#endif
 
-        cbuf_read(wbuf, NULL, len, NULL);
+    if (_g_dtty_uart.fd <= 0 || _g_dtty_uart_panic)
+    {
+        return;
+    }
 
-        if (cbuf_get_len(wbuf) == 0)
+    _g_dtty_uart_panic = 1;
+
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+    /* Write out the published records (the writer task may have been stopped in the middle of one) */
+    for (tail = _g_dtty_uart_log_tail; tail != _g_dtty_uart_log_head; tail += size)
+    {
+        pos = tail & (DTTY_UART_LOG_BUFFER_SIZE - 1);
+        hdr = _g_dtty_uart_log_buf[pos / 4];
+        if ((hdr & DTTY_UART_LOG_READY) == 0)
         {
-            if (_bsp_kernel_active)
-            {
-                sem_give(wsem);
-            }
-            _g_dtty_uart_need_tx_restart = 1;
             break;
         }
-
-        buf = cbuf_get_head_addr(wbuf);
-        _g_dtty_uart_need_tx_restart = 0;
-        if (HAL_UART_Transmit_IT(&DTTY_STM32_UART_HANDLE, buf, len) != HAL_OK)
+        if (hdr & DTTY_UART_LOG_PAD)
         {
-            _g_dtty_uart_need_tx_restart = 1;
-            break;
+            size = hdr & DTTY_UART_LOG_LEN_MASK;
         }
-    } while (0);
-}
-
-void dtty_stm32_uart_err_callback(void)
-{
-    _g_dtty_uart_need_reset = 1;
+        else
+        {
+            _dtty_emit((const uint8_t *) &_g_dtty_uart_log_buf[pos / 4 + 1], hdr & DTTY_UART_LOG_LEN_MASK);
+            size = 4 + (((hdr & DTTY_UART_LOG_LEN_MASK) + 3) & ~3);
+        }
+    }
+#endif
 }
 
 int dtty_init(void)
 {
     int r;
-    uint8_t * buf;
-    uint16_t len;
+    ubi_st_t ubi_err;
+    ubidrv_uart_ext_t ext;
     (void) r;
+    (void) ubi_err;
 
     do
     {
@@ -227,39 +409,38 @@ int dtty_init(void)
 
         _g_bsp_dtty_in_init = 1;
 
-        r = semb_create(&_g_dtty_uart_rsem);
-        assert(r == 0);
-        r = semb_create(&_g_dtty_uart_wsem);
+        _g_dtty_uart.baud_rate = STM32CUBEF2__DTTY_STM32_UART_BAUD_RATE;
+        _g_dtty_uart.data_bits = UBIDRV_UART_DATA_BITS_8;
+        _g_dtty_uart.stop_bits = UBIDRV_UART_STOP_BITS_1;
+        _g_dtty_uart.parity_type = UBIDRV_UART_PARITY_TYPE_NONE;
+        _g_dtty_uart.hw_flow_ctl = UBIDRV_UART_HW_FLOW_CTRL_NONE;
+
+        ubidrv_uart_ext_init(&ext);
+        ext.read_buffer_size = DTTY_UART_READ_BUFFER_SIZE;
+        ext.write_buffer_size = DTTY_UART_WRITE_BUFFER_SIZE;
+        ext.read_buffer = _g_dtty_uart_read_buffer;
+        ext.write_buffer = _g_dtty_uart_write_buffer;
+        ext.irq_priority = NVIC_PRIO_MIDDLE;
+        ext.hal_uart = &DTTY_STM32_UART_HANDLE;
+
+        ubi_err = ubidrv_uart_open_ext(&_g_dtty_uart, &ext);
+        assert(ubi_err == UBI_ST_OK);
+
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+        r = semb_create(&_g_dtty_uart_log_sem);
         assert(r == 0);
-        r = mutex_create(&_g_dtty_uart_resetlock);
+        r = mutex_create(&_g_dtty_uart_log_lock);
         assert(r == 0);
-        r = mutex_create(&_g_dtty_uart_putlock);
-        assert(r == 0);
-        r = mutex_create(&_g_dtty_uart_getlock);
+        r = task_create(NULL, _dtty_write_task, NULL, task_getlowestpriority(), DTTY_UART_WRITE_TASK_STACK_DEPTH, "dtty_write");
         assert(r == 0);
+#endif
 
         _g_bsp_dtty_echo = 1;
         _g_bsp_dtty_autocr = 1;
 
-        _g_dtty_uart_rx_overflow_count = 0;
-        _g_dtty_uart_tx_overflow_count = 0;
-        _g_dtty_uart_need_reset = 1;
-
-        _dtty_stm32_uart_reset();
-
-        _g_dtty_uart_reset_count = 0;
-
         _g_bsp_dtty_init = 1;
 
-        cbuf_clear(_g_dtty_uart_rbuf);
-
-        buf = cbuf_get_tail_addr(_g_dtty_uart_rbuf);
-        len = 1;
-        _g_dtty_uart_need_rx_restart = 0;
-        if (HAL_UART_Receive_IT(&DTTY_STM32_UART_HANDLE, buf, len) != HAL_OK)
-        {
-            _g_dtty_uart_need_rx_restart = 1;
-        }
+        _dtty_apply_policy();
 
         _g_bsp_dtty_in_init = 0;
 
@@ -287,9 +468,7 @@ int dtty_geterror(void)
 static int _dtty_getc_advan(char *ch_p, int blocked)
 {
     int r;
-    ubi_err_t ubi_err;
-    uint8_t * buf;
-    uint16_t len;
+    ubi_st_t ubi_err;
 
     r = -1;
     do
@@ -308,63 +487,29 @@ static int _dtty_getc_advan(char *ch_p, int blocked)
             }
         }
 
+        _dtty_apply_policy();
+
         if (!blocked)
         {
-            r = mutex_lock_timed(_g_dtty_uart_getlock, 0);
+            ubi_err = ubidrv_uart_getc_unblocked(_g_dtty_uart.fd, ch_p);
         }
         else
         {
-            r = mutex_lock(_g_dtty_uart_getlock);
+            ubi_err = ubidrv_uart_getc(_g_dtty_uart.fd, ch_p);
         }
-        if (r != 0)
+        if (ubi_err != UBI_ST_OK)
         {
             break;
         }
 
-        for (;;)
-        {
-            if (_g_dtty_uart_need_reset)
-            {
-                _dtty_stm32_uart_reset();
-            }
-
-            if (_g_dtty_uart_need_rx_restart)
-            {
-                len = 1;
-
-                buf = cbuf_get_tail_addr(_g_dtty_uart_rbuf);
-                _g_dtty_uart_need_rx_restart = 0;
-                if (HAL_UART_Receive_IT(&DTTY_STM32_UART_HANDLE, buf, len) != HAL_OK)
-                {
-                    _g_dtty_uart_need_rx_restart = 1;
-                }
-            }
-
-            ubi_err = cbuf_read(_g_dtty_uart_rbuf, (uint8_t*) ch_p, 1, NULL);
-            if (ubi_err == UBI_ERR_OK)
-            {
-                r = 0;
-                break;
-            }
-            else
-            {
-                if (!blocked)
-                {
-                    break;
-                }
-                else
-                {
-                    sem_take_timedms(_g_dtty_uart_rsem, DTTY_UART_CHECK_INTERVAL_MS);
-                }
-            }
-        }
+        r = 0;
 
-        if (0 == r && 0 != _g_bsp_dtty_echo)
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+        if (0 != _g_bsp_dtty_echo)
         {
             dtty_putc(*ch_p);
         }
-
-        mutex_unlock(_g_dtty_uart_getlock);
+#endif
 
         break;
     } while (1);
@@ -385,16 +530,30 @@ int dtty_getc_unblocked(char *ch_p)
 int dtty_putc(int ch)
 {
     int r;
-    uint8_t * buf;
-    uint16_t len;
-    uint32_t written;
-    uint8_t data[2];
+    ubi_st_t ubi_err;
+    uint8_t data;
 
     r = -1;
     do
     {
+        data = (uint8_t) ch;
+
+        if (_g_dtty_uart_panic)
+        {
+            _dtty_emit(&data, 1);
+            r = 0;
+            break;
+        }
+
         if (bsp_isintr() || 0 != _bsp_critcount)
         {
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+            /* Only queue; init and the policy update need the kernel */
+            if (_g_bsp_dtty_init && _dtty_log_put(&data, 1) == 1)
+            {
+                r = 0;
+            }
+#endif
             break;
         }
 
@@ -407,57 +566,23 @@ int dtty_putc(int ch)
             }
         }
 
-        mutex_lock(_g_dtty_uart_putlock);
+        _dtty_apply_policy();
 
-        do
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+        if (_dtty_log_put(&data, 1) != 1)
+        {
+            break;
+        }
+        (void) ubi_err;
+#else
+        ubi_err = ubidrv_uart_putc(_g_dtty_uart.fd, ch);
+        if (ubi_err != UBI_ST_OK)
         {
-            if (_g_dtty_uart_need_reset)
-            {
-                _dtty_stm32_uart_reset();
-            }
-
-            if (0 != _g_bsp_dtty_autocr && '\n' == ch)
-            {
-                data[0] = '\r';
-                data[1] = '\n';
-                len = 2;
-            }
-            else
-            {
-                data[0] = (uint8_t) ch;
-                len = 1;
-            }
-
-            if (cbuf_get_len(_g_dtty_uart_wbuf) == 0)
-            {
-                sem_clear(_g_dtty_uart_wsem);
-                _g_dtty_uart_need_tx_restart = 1;
-            }
-
-            cbuf_write(_g_dtty_uart_wbuf, data, len, &written);
-            if (written == 0)
-            {
-                _g_dtty_uart_tx_overflow_count++;
-            }
-
-            if (_g_dtty_uart_need_tx_restart)
-            {
-                len = 1;
-
-                buf = cbuf_get_head_addr(_g_dtty_uart_wbuf);
-                _g_dtty_uart_need_tx_restart = 0;
-                if (HAL_UART_Transmit_IT(&DTTY_STM32_UART_HANDLE, buf, len) != HAL_OK)
-                {
-                    _g_dtty_uart_need_tx_restart = 1;
-                    break;
-                }
-            }
-
-            r = 0;
             break;
-        } while (1);
+        }
+#endif
 
-        mutex_unlock(_g_dtty_uart_putlock);
+        r = 0;
 
         break;
     } while (1);
@@ -468,12 +593,18 @@ int dtty_putc(int ch)
 int dtty_flush(void)
 {
     int r;
-    uint8_t * buf;
-    uint16_t len;
+    ubi_st_t ubi_err;
 
     r = -1;
     do
     {
+        if (_g_dtty_uart_panic)
+        {
+            /* Polled writes are already on the wire */
+            r = 0;
+            break;
+        }
+
         if (bsp_isintr() || 0 != _bsp_critcount)
         {
             break;
@@ -488,42 +619,21 @@ int dtty_flush(void)
             }
         }
 
-        mutex_lock(_g_dtty_uart_putlock);
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+        dtty_write_process(NULL);
+#endif
 
-        for (;;)
+        ubi_err = ubidrv_uart_flush(_g_dtty_uart.fd);
+        if (ubi_err != UBI_ST_OK)
         {
-            if (_g_dtty_uart_need_reset)
-            {
-                _dtty_stm32_uart_reset();
-            }
-
-            if (_g_dtty_uart_need_tx_restart && cbuf_get_len(_g_dtty_uart_wbuf) > 0)
-            {
-                len = 1;
-
-                buf = cbuf_get_head_addr(_g_dtty_uart_wbuf);
-                _g_dtty_uart_need_tx_restart = 0;
-                if (HAL_UART_Transmit_IT(&DTTY_STM32_UART_HANDLE, buf, len) != HAL_OK)
-                {
-                    _g_dtty_uart_need_tx_restart = 1;
-                    break;
-                }
-            }
-
-            if (cbuf_get_len(_g_dtty_uart_wbuf) == 0)
-            {
-                r = 0;
-                break;
-            }
-
-            sem_take_timedms(_g_dtty_uart_wsem, DTTY_UART_CHECK_INTERVAL_MS);
+            break;
         }
 
-        mutex_unlock(_g_dtty_uart_putlock);
+        r = 0;
 
         break;
     } while (1);
- 
+
     return r;
 }
 
@@ -534,38 +644,57 @@ int dtty_putn(const char *str, int len)
     r = -1;
     do
     {
-        if (bsp_isintr() || 0 != _bsp_critcount)
+        if (NULL == str)
         {
+            r = -2;
             break;
         }
 
-        if (!_g_bsp_dtty_init)
+        if (0 > len)
         {
-            dtty_init();
-            if (!_g_bsp_dtty_init)
-            {
-                break;
-            }
+            r = -3;
+            break;
         }
 
-        if (NULL == str)
+        if (_g_dtty_uart_panic)
         {
-            r = -2;
+            _dtty_emit((const uint8_t *) str, len);
+            r = len;
             break;
         }
 
-        if (0 > len)
+        if (bsp_isintr() || 0 != _bsp_critcount)
         {
-            r = -3;
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+            /* Only queue; init and the policy update need the kernel */
+            if (_g_bsp_dtty_init)
+            {
+                r = _dtty_log_put((const uint8_t *) str, len);
+            }
+#endif
             break;
         }
 
-        for (r = 0; r < len; r++)
+        if (!_g_bsp_dtty_init)
         {
-            dtty_putc(*str);
-            str++;
+            dtty_init();
+            if (!_g_bsp_dtty_init)
+            {
+                break;
+            }
         }
 
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+        _dtty_apply_policy();
+
+        r = _dtty_log_put((const uint8_t *) str, len);
+#else
+        _dtty_apply_policy();
+
+        /* One hold of the write lock and one copy per newline-free run */
+        r = ubidrv_uart_putn(_g_dtty_uart.fd, str, len);
+#endif
+
         break;
     } while (1);
 
@@ -593,14 +722,7 @@ int dtty_kbhit(void)
             }
         }
 
-        if (cbuf_get_len(_g_dtty_uart_rbuf) != 0)
-        {
-            r = 1;
-        }
-        else
-        {
-            r = 0;
-        }
+        r = ubidrv_uart_kbhit(_g_dtty_uart.fd);
 
         break;
     } while (1);
@@ -608,10 +730,88 @@ int dtty_kbhit(void)
     return r;
 }
 
+#if (STM32CUBEF2__DTTY_STM32_UART_NEWLIB_WRITE == 1)
+
+/* newlib output of stdout and stderr, so that a buffered printf line goes out by a single dtty_putn */
+int _write(int file, char *ptr, int len)
+{
+    int r;
+
+    if (file != STDOUT_FILENO && file != STDERR_FILENO)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    r = dtty_putn(ptr, len);
+    if (r < 0)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    /* What did not fit is dropped (and counted), not retried */
+    return len;
+}
+
+#endif /* (STM32CUBEF2__DTTY_STM32_UART_NEWLIB_WRITE == 1) */
+
 void dtty_write_process(void *arg)
 {
+#if (DTTY_UART_LOG_BUFFER_SIZE > 0)
+    uint32_t tail;
+    uint32_t pos;
+    uint32_t hdr;
+    uint32_t size;
+    (void) arg;
+
+    if (bsp_isintr() || 0 != _bsp_critcount || !_g_bsp_dtty_init || _g_dtty_uart_panic)
+    {
+        return;
+    }
+
+    mutex_lock(_g_dtty_uart_log_lock);
+
+    for (;;)
+    {
+        tail = _g_dtty_uart_log_tail;
+        if (tail == _g_dtty_uart_log_head)
+        {
+            break;
+        }
+
+        pos = tail & (DTTY_UART_LOG_BUFFER_SIZE - 1);
+        hdr = _g_dtty_uart_log_buf[pos / 4];
+        if ((hdr & DTTY_UART_LOG_READY) == 0)
+        {
+            /* Reserved but not published yet; its writer wakes us up */
+            break;
+        }
+        __DMB();
+
+        if (hdr & DTTY_UART_LOG_PAD)
+        {
+            size = hdr & DTTY_UART_LOG_LEN_MASK;
+        }
+        else
+        {
+            _dtty_emit((const uint8_t *) &_g_dtty_uart_log_buf[pos / 4 + 1], hdr & DTTY_UART_LOG_LEN_MASK);
+            size = 4 + (((hdr & DTTY_UART_LOG_LEN_MASK) + 3) & ~3);
+        }
+
+        memset(&_g_dtty_uart_log_buf[pos / 4], 0, size);
+        __DMB();
+        _g_dtty_uart_log_tail = tail + size;
+    }
+
+    mutex_unlock(_g_dtty_uart_log_lock);
+#else
+    (void) arg;
+#endif
 }
 
+#endif /* (UBINOS__UBIDRV__INCLUDE_UART == 1) && (UBINOS__BSP__BOARD_MODEL == UBINOS__BSP__BOARD_MODEL__NUCLEOF207ZG) */
+
 #endif /* (STM32CUBEF2__DTTY_STM32_UART_ENABLE == 1) */
 
 #endif /* (UBINOS__BSP__DTTY_TYPE == UBINOS__BSP__DTTY_TYPE__EXTERNAL) */
@@ -619,4 +819,3 @@ void dtty_write_process(void *arg)
 #endif /* (UBINOS__BSP__USE_DTTY == 1) */
 
 #endif /* (INCLUDE__UBINOS__BSP == 1) */
-